@@ -0,0 +1,357 @@
+#include "batchsolver.h"
+#include "multistart.h"
+#include "parser.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <future>
+#include <sstream>
+
+
+namespace {
+
+std::string escape(const std::string &s)
+{
+    std::string result = "\"";
+    for (char c : s) {
+        switch (c) {
+        case '"':
+            result += "\\\"";
+            break;
+        case '\\':
+            result += "\\\\";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        case '\t':
+            result += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                result += buf;
+            } else {
+                result += c;
+            }
+        }
+    }
+
+    return result + "\"";
+}
+
+std::string number(double x)
+{
+    if (!std::isfinite(x)) {
+        return "null";
+    }
+
+    std::ostringstream s;
+    s.precision(17);
+    s << x;
+    return s.str();
+}
+
+// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+bool is_json_number(const std::string &s)
+{
+    std::size_t i = 0;
+    auto digits = [&s, &i] {
+        std::size_t begin = i;
+        while (i < s.size() && std::isdigit(static_cast<unsigned char>(s[i]))) {
+            ++i;
+        }
+        return i - begin;
+    };
+
+    if (i < s.size() && s[i] == '-') {
+        ++i;
+    }
+    if (i < s.size() && s[i] == '0') {
+        ++i;
+    } else if (digits() == 0) {
+        return false;
+    }
+    if (i < s.size() && s[i] == '.') {
+        ++i;
+        if (digits() == 0) {
+            return false;
+        }
+    }
+    if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+        ++i;
+        if (i < s.size() && (s[i] == '+' || s[i] == '-')) {
+            ++i;
+        }
+        if (digits() == 0) {
+            return false;
+        }
+    }
+
+    return i == s.size();
+}
+
+// Just enough JSON for one flat object per line: string, number, literal and array of strings values
+class JsonLine
+{
+    const std::string &s_;
+    std::size_t pos_{0};
+public:
+    JsonLine(const std::string &s) : s_(s) {}
+
+    void read(BatchSolver::System &system)
+    {
+        expect('{');
+        if (peek() == '}') {
+            ++pos_;
+            return;
+        }
+
+        do {
+            std::string key = string();
+            expect(':');
+            if (key == "variables") {
+                system.variables = string();
+            } else if (key == "equations") {
+                system.equations = peek() == '[' ? lines() : string();
+            } else if (key == "id") {
+                system.id = id();
+            } else {
+                raw();
+            }
+        } while (next(',', '}'));
+    }
+private:
+    char peek()
+    {
+        while (pos_ < s_.size() && std::isspace(static_cast<unsigned char>(s_[pos_]))) {
+            ++pos_;
+        }
+        if (pos_ == s_.size()) {
+            throw std::string{"invalid json"};
+        }
+
+        return s_[pos_];
+    }
+
+    void expect(char c)
+    {
+        if (peek() != c) {
+            throw std::string{"invalid json"};
+        }
+        ++pos_;
+    }
+
+    // true on more, false on end
+    bool next(char more, char end)
+    {
+        char c = peek();
+        if (c != more && c != end) {
+            throw std::string{"invalid json"};
+        }
+        ++pos_;
+
+        return c == more;
+    }
+
+    std::string string()
+    {
+        expect('"');
+        std::string result;
+        while (pos_ < s_.size() && s_[pos_] != '"') {
+            char c = s_[pos_++];
+            if (c != '\\') {
+                result += c;
+                continue;
+            }
+            if (pos_ == s_.size()) {
+                break;
+            }
+
+            c = s_[pos_++];
+            switch (c) {
+            case 'n':
+                result += '\n';
+                break;
+            case 't':
+                result += '\t';
+                break;
+            case 'r':
+                result += '\r';
+                break;
+            case 'b':
+                result += '\b';
+                break;
+            case 'f':
+                result += '\f';
+                break;
+            case 'u':
+                if (pos_ + 4 > s_.size()) {
+                    throw std::string{"invalid json"};
+                }
+                result += static_cast<char>(std::stoi(s_.substr(pos_, 4), nullptr, 16)); // equations are ASCII
+                pos_ += 4;
+                break;
+            default:
+                result += c;
+            }
+        }
+        expect('"');
+
+        return result;
+    }
+
+    // array of strings joined by new lines
+    std::string lines()
+    {
+        expect('[');
+        std::string result;
+        if (peek() == ']') {
+            ++pos_;
+            return result;
+        }
+
+        do {
+            result += string() + "\n";
+        } while (next(',', ']'));
+
+        return result;
+    }
+
+    // a string or a number as the text written back into the output
+    std::string id()
+    {
+        if (peek() == '"') {
+            return escape(string());
+        }
+
+        std::string text = raw();
+        if (!is_json_number(text)) {
+            throw std::string{"invalid id"};
+        }
+
+        return text;
+    }
+
+    // any value as its text
+    std::string raw()
+    {
+        char c = peek();
+        if (c == '"') {
+            return escape(string());
+        }
+        if (c == '{' || c == '[') {
+            throw std::string{"invalid json"};
+        }
+
+        std::size_t begin = pos_;
+        while (pos_ < s_.size() && s_[pos_] != ',' && s_[pos_] != '}' && !std::isspace(static_cast<unsigned char>(s_[pos_]))) {
+            ++pos_;
+        }
+
+        return s_.substr(begin, pos_ - begin);
+    }
+};
+
+} // namespace
+
+
+BatchSolver::BatchSolver(std::shared_ptr<ThreadPool> pool, std::size_t window, std::size_t starts, std::shared_ptr<SystemCache> cache)
+    : pool_(pool), window_(window ? window : 4 * pool->size()), starts_(starts), cache_(cache) {}
+
+std::size_t BatchSolver::operator()(std::istream &in, std::ostream &out)
+{
+    std::deque<std::future<std::string>> pending;
+    std::size_t count = 0;
+    System system;
+    while (read_system(in, system)) {
+        if (system.id.empty()) {
+            system.id = std::to_string(count);
+        }
+
+        if (pending.size() >= window_) {
+            out << pending.front().get() << '\n';
+            pending.pop_front();
+        }
+        pending.push_back(pool_->submit([this, system = std::move(system)] { return solve(system); }));
+        system = System{};
+        ++count;
+    }
+
+    while (!pending.empty()) {
+        out << pending.front().get() << '\n';
+        pending.pop_front();
+    }
+    out.flush();
+
+    return count;
+}
+
+bool BatchSolver::read_system(std::istream &in, System &system)
+{
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        if (line[0] == '{') {
+            try {
+                JsonLine(line).read(system);
+            } catch (const std::string &error) {
+                system.error = error;
+            } catch (const std::exception &) {
+                system.error = "invalid json";
+            }
+            return true;
+        }
+
+        system.variables = line;
+        while (std::getline(in, line) && !line.empty()) {
+            system.equations += line + "\n";
+        }
+        return true;
+    }
+
+    return false;
+}
+
+std::string BatchSolver::solve(const System &system) const
+{
+    std::string result = "{\"id\":" + system.id + ",";
+    try {
+        if (!system.error.empty()) {
+            throw system.error;
+        }
+
+        std::string key = cache_ ? SystemCache::key_of(system.variables, system.equations) : "";
+        std::shared_ptr<const Tape> tape = cache_ ? cache_->find(key) : nullptr;
+        if (!tape) {
+            Parser parser;
+            parser.add_variables(system.variables);
+            tape = std::make_shared<const Tape>(parser.make_equation(system.equations), parser.get_variables());
+            if (cache_) {
+                cache_->insert(key, tape);
+            }
+        }
+        MultiStartSolver::Result best = MultiStartSolver(nullptr, starts_)(tape, StopCriteria::with_stall_detection());
+
+        // same tolerance as the answer of Model
+        result += "\"solved\":" + std::string(best.loss <= 1e-5 ? "true" : "false") + ",\"loss\":" + number(best.loss) + ",\"solution\":{";
+        auto &parameters = tape->get_parameters();
+        for (std::size_t i = 0; i < parameters.size(); ++i) {
+            result += (i ? "," : "") + escape(parameters[i]->get_name()) + ":" + number(best.solution[i]);
+        }
+        result += "}}";
+    } catch (const std::string &error) {
+        result += "\"error\":" + escape(error) + "}";
+    } catch (const std::exception &error) {
+        result += "\"error\":" + escape(error.what()) + "}";
+    }
+
+    return result;
+}
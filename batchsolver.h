@@ -0,0 +1,53 @@
+#ifndef BATCHSOLVER_H
+#define BATCHSOLVER_H
+
+#include "systemcache.h"
+#include "threadpool.h"
+
+#include <cstddef>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+
+// Streams independent systems from a JSON-lines or plain text input, solves them on a thread pool
+// and writes one JSON line per system in input order. At most window systems are in flight,
+// so memory does not grow with the size of the input.
+//
+// JSON lines:  {"id": 7, "variables": "x y", "equations": ["x + y - 3", "x - y - 1"]}
+//              equations may also be one string with '\n' between the equations, id is optional
+//              and must be a string or a number
+// Plain text:  the variables line and the equation lines of a system, systems are separated by empty lines
+//
+// Output:      {"id":7,"solved":true,"loss":1e-31,"solution":{"x":2,"y":1}}
+//              {"id":8,"error":"invalid exp"}
+// Systems without an id get their 0-based position in the input.
+class BatchSolver
+{
+    std::shared_ptr<ThreadPool> pool_;
+    std::size_t window_;
+    std::size_t starts_;
+    std::shared_ptr<SystemCache> cache_;
+public:
+    struct System
+    {
+        std::string id{};
+        std::string variables{};
+        std::string equations{};
+        std::string error{};
+    };
+
+    // 0 window means four systems per thread of the pool,
+    // each system tries up to starts starting points one after another in its worker,
+    // repeated systems reuse their compiled tape from cache when it is given
+    BatchSolver(std::shared_ptr<ThreadPool> pool, std::size_t window = 0, std::size_t starts = 4, std::shared_ptr<SystemCache> cache = nullptr);
+
+    // returns the number of systems written to out
+    std::size_t operator()(std::istream &in, std::ostream &out);
+
+private:
+    std::string solve(const System &system) const;
+    static bool read_system(std::istream &in, System &system);
+};
+
+#endif // BATCHSOLVER_H
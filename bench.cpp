@@ -0,0 +1,368 @@
+#include "differentiable.h"
+#include "levenbergmarquardt.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "residuals.h"
+#include "tape.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Regression benchmarks of the engine. Sizes are the arguments of each benchmark:
+// variables, depth of the expression and the percentage of shared subexpressions, or the number of equations.
+// Every benchmark reports allocs/iter, the expression ones s/node over the distinct nodes.
+//
+//     autodiff_bench --benchmark_filter=Tape
+
+
+//Allocation counter: every operator new of the process, the over-aligned ones excepted which the engine never uses
+
+namespace {
+std::atomic<std::size_t> allocations{0};
+
+void* allocate(std::size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void* allocate_or_throw(std::size_t size)
+{
+    if (void *p = allocate(size)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+}
+
+// GCC inlines the replacements into new and delete expressions and then takes free() for a mismatch
+// with operator new, yet every operator new here returns memory from malloc
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+    return allocate_or_throw(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return allocate_or_throw(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+
+namespace {
+
+// counts the allocations of the timed loop
+class AllocationCounter
+{
+    benchmark::State &state_;
+    std::size_t start_;
+public:
+    AllocationCounter(benchmark::State &state) : state_(state), start_(allocations.load()) {}
+
+    ~AllocationCounter()
+    {
+        state_.counters["allocs/iter"] = benchmark::Counter(static_cast<double>(allocations.load() - start_) / state_.iterations());
+    }
+};
+
+void per_node(benchmark::State &state, std::size_t nodes)
+{
+    state.counters["nodes"] = static_cast<double>(nodes);
+    state.counters["s/node"] = benchmark::Counter(static_cast<double>(nodes),
+        benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+// random expression of the given depth over parameters, share percent of the subtrees are
+// taken again from the ones built before, which makes a DAG
+class ExpressionMaker
+{
+    const std::vector<std::shared_ptr<Parameter>> &parameters_;
+    int share_;
+    std::mt19937 random_{42};
+    std::vector<std::shared_ptr<Differentiable>> built_{};
+public:
+    ExpressionMaker(const std::vector<std::shared_ptr<Parameter>> &parameters, int share) : parameters_(parameters), share_(share) {}
+
+    std::shared_ptr<Differentiable> operator()(int depth)
+    {
+        if (!built_.empty() && static_cast<int>(random_() % 100) < share_) {
+            return built_[random_() % built_.size()];
+        }
+        if (depth == 0) {
+            return std::make_shared<Var>(parameters_[random_() % parameters_.size()]);
+        }
+
+        std::shared_ptr<Differentiable> node;
+        switch (random_() % 6) {
+        case 0:
+            node = (*this)(depth - 1) + (*this)(depth - 1);
+            break;
+        case 1:
+            node = (*this)(depth - 1) - (*this)(depth - 1);
+            break;
+        case 2:
+            node = (*this)(depth - 1) * (*this)(depth - 1);
+            break;
+        case 3:
+            node = (*this)(depth - 1) / (d_cos((*this)(depth - 1)) + CONST(2));
+            break;
+        case 4:
+            node = d_sin((*this)(depth - 1));
+            break;
+        default:
+            node = d_pow((*this)(depth - 1), CONST(2));
+            break;
+        }
+        built_.push_back(node);
+
+        return node;
+    }
+};
+
+std::vector<std::shared_ptr<Parameter>> make_parameters(int count)
+{
+    std::vector<std::shared_ptr<Parameter>> parameters;
+    for (int i = 0; i < count; ++i) {
+        parameters.push_back(std::make_shared<Parameter>(0.1 * (i + 1), true, "x" + std::to_string(i)));
+    }
+
+    return parameters;
+}
+
+// variables "x0 x1 ..." and count coupled equations xi * x(i+1) + sin xi - 1 - sin 1, all ones is a root
+std::string make_variables(int count)
+{
+    std::string s;
+    for (int i = 0; i < count; ++i) {
+        s += "x" + std::to_string(i) + " ";
+    }
+
+    return s;
+}
+
+std::string make_equations(int count)
+{
+    std::ostringstream c;
+    c.precision(17);
+    c << 1 + std::sin(1.0);
+
+    std::string s;
+    for (int i = 0; i < count; ++i) {
+        const std::string x = "x" + std::to_string(i);
+        const std::string y = "x" + std::to_string((i + 1) % count);
+        s += x + " * " + y + " + sin " + x + " - " + c.str() + "\n";
+    }
+
+    return s;
+}
+
+void expression_sizes(benchmark::internal::Benchmark *b)
+{
+    b->ArgNames({"vars", "depth", "share"});
+    for (int vars : {4, 64}) {
+        for (int depth : {6, 10}) {
+            for (int share : {0, 30}) {
+                b->Args({vars, depth, share});
+            }
+        }
+    }
+}
+
+} // namespace
+
+
+//Differentiable tree
+
+void BM_TreeEvaluate(benchmark::State &state)
+{
+    auto parameters = make_parameters(state.range(0));
+    auto f = ExpressionMaker(parameters, state.range(2))(state.range(1));
+
+    per_node(state, Tape(f).size());
+
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize((*f)());
+    }
+}
+BENCHMARK(BM_TreeEvaluate)->Apply(expression_sizes);
+
+void BM_TreeGradient(benchmark::State &state)
+{
+    auto parameters = make_parameters(state.range(0));
+    auto f = ExpressionMaker(parameters, state.range(2))(state.range(1));
+
+    per_node(state, Tape(f).size());
+
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(f->make_grad(DiffMode::reverse));
+    }
+}
+BENCHMARK(BM_TreeGradient)->Apply(expression_sizes);
+
+
+//Tape
+
+void BM_TapeEvaluate(benchmark::State &state)
+{
+    auto parameters = make_parameters(state.range(0));
+    Tape tape(ExpressionMaker(parameters, state.range(2))(state.range(1)));
+    TapeState tape_state = tape.make_state();
+
+    per_node(state, tape.size());
+
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tape(tape_state));
+    }
+}
+BENCHMARK(BM_TapeEvaluate)->Apply(expression_sizes);
+
+template<DiffMode mode>
+void BM_TapeGradient(benchmark::State &state)
+{
+    auto parameters = make_parameters(state.range(0));
+    Tape tape(ExpressionMaker(parameters, state.range(2))(state.range(1)));
+    TapeState tape_state = tape.make_state();
+    Grad<double> gradient(std::vector<double>(tape.get_parameters().size(), 0));
+
+    per_node(state, tape.size());
+
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        tape.make_grad(tape_state, gradient, mode);
+        benchmark::DoNotOptimize(gradient[0]);
+    }
+}
+BENCHMARK_TEMPLATE(BM_TapeGradient, DiffMode::reverse)->Apply(expression_sizes);
+BENCHMARK_TEMPLATE(BM_TapeGradient, DiffMode::forward)->Apply(expression_sizes);
+
+
+//Parser
+
+void BM_Parse(benchmark::State &state)
+{
+    const std::string variables = make_variables(state.range(0));
+    const std::string equations = make_equations(state.range(0));
+    Parser parser;
+    parser.add_variables(variables);
+
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(parser.make_equation(equations));
+    }
+    state.SetBytesProcessed(state.iterations() * equations.size());
+}
+BENCHMARK(BM_Parse)->ArgName("equations")->RangeMultiplier(8)->Range(8, 4096);
+
+
+//Solvers: a full solve from the same start per iteration
+
+void BM_AdamSolve(benchmark::State &state)
+{
+    Parser parser;
+    parser.add_variables(make_variables(state.range(0)));
+    auto tape = std::make_shared<const Tape>(parser.make_equation(make_equations(state.range(0))), parser.get_variables());
+    const std::vector<double> start(tape->get_parameters().size(), 0.5);
+
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        Optimizer optimizer(tape, start, 0.01);
+        optimizer();
+        state.counters["loss"] = optimizer.get_loss();
+    }
+}
+BENCHMARK(BM_AdamSolve)->ArgName("equations")->Arg(2)->Arg(8)->Arg(32)->Unit(benchmark::kMillisecond);
+
+void BM_LbfgsSolve(benchmark::State &state)
+{
+    Parser parser;
+    parser.add_variables(make_variables(state.range(0)));
+    auto tape = std::make_shared<const Tape>(parser.make_equation(make_equations(state.range(0))), parser.get_variables());
+    const std::vector<double> start(tape->get_parameters().size(), 0.5);
+
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        Optimizer optimizer(tape, start);
+        optimizer.set_method(OptimizerMethod::lbfgs);
+        optimizer();
+        state.counters["loss"] = optimizer.get_loss();
+    }
+}
+BENCHMARK(BM_LbfgsSolve)->ArgName("equations")->Arg(2)->Arg(8)->Arg(32)->Arg(256)->Unit(benchmark::kMillisecond);
+
+void BM_LevenbergMarquardtSolve(benchmark::State &state)
+{
+    Parser parser;
+    parser.add_variables(make_variables(state.range(0)));
+    auto residuals = std::make_shared<const Residuals>(parser.make_residuals(make_equations(state.range(0))), parser.get_variables());
+    const std::vector<double> start(residuals->get_parameters().size(), 0.5);
+
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        LevenbergMarquardt solver(residuals, start);
+        solver();
+        state.counters["loss"] = solver.get_loss();
+    }
+}
+BENCHMARK(BM_LevenbergMarquardtSolve)->ArgName("equations")->Arg(2)->Arg(8)->Arg(32)->Arg(256)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,90 @@
+#include "batchsolver.h"
+#include "model.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Headless solver: reads a system from the file given as the only argument or from stdin.
+// The first line that is not empty and not a comment lists the variables, the rest are equations:
+//
+//     x y
+//     x + y - 3
+//     x - y - 1
+//
+// Prints "name value" per variable, or "no decision" and exits with 1 when no root is found.
+//
+// With --batch the input is a stream of systems solved on all cores, see batchsolver.h for the format.
+// With --profile the counters of the solve go to stderr as one JSON line, see profiler.h.
+
+int main(int argc, char *argv[])
+{
+    bool batch = false;
+    bool profile = false;
+    int path = 1;
+    for (; path < argc && std::string(argv[path]).rfind("--", 0) == 0; ++path) {
+        batch = batch || std::string(argv[path]) == "--batch";
+        profile = profile || std::string(argv[path]) == "--profile";
+    }
+
+    std::ifstream file;
+    if (argc > path) {
+        file.open(argv[path]);
+        if (!file) {
+            std::cerr << "can not open " << argv[path] << std::endl;
+            return 2;
+        }
+    }
+    std::istream &in = argc > path ? file : std::cin;
+
+    if (batch) {
+        std::ios::sync_with_stdio(false);
+        auto cache = std::make_shared<SystemCache>();
+        BatchSolver(std::make_shared<ThreadPool>(), 0, 4, cache)(in, std::cout);
+        std::cerr << "compiled systems cache: " << cache->hits() << " hits, " << cache->misses() << " misses" << std::endl;
+        if (profile) {
+            std::cerr << Profiler::snapshot().to_json() << std::endl;
+        }
+        return 0;
+    }
+
+    std::string variables;
+    std::string equations;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        if (variables.empty()) {
+            variables = line;
+        } else {
+            equations += line + "\n";
+        }
+    }
+
+    try {
+        Model model;
+        model.add_variables(variables);
+        double loss = model.solve_now(equations);
+        if (profile) {
+            std::cerr << model.get_profile().to_json() << std::endl;
+        }
+        if (!(loss <= 1e-5)) {
+            std::cout << "no decision" << std::endl;
+            return 1;
+        }
+
+        std::cout << std::setprecision(17);
+        for (auto &v : model.get_variables()) {
+            std::cout << v->get_name() << " " << v->get_value() << "\n";
+        }
+    } catch (const std::string &error) {
+        std::cerr << error << std::endl;
+        return 2;
+    }
+
+    return 0;
+}
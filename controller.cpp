@@ -5,7 +5,14 @@
 Controller::Controller(QWidget *parent) : QWidget(parent), variables(new QTextEdit), equations(new QTextEdit), b_solve(new QPushButton("SOLVE")),
     view(std::make_shared<View>(parent, variables, equations, b_solve))
 {
-    model = std::make_shared<Model>(view);
+    std::weak_ptr<View> weak_view = view;
+    model = std::make_shared<Model>([weak_view](std::string answer) {
+        auto view = weak_view.lock();
+        if (view) {
+            // the answer comes from a solver thread, widgets are touched only in the GUI thread
+            QMetaObject::invokeMethod(view.get(), [view, answer] { view->display_decision(answer); });
+        }
+    });
     connect(b_solve, &QPushButton::clicked, this, &Controller::solve_equations);
 
     QVBoxLayout *layout = new QVBoxLayout();
@@ -1,9 +1,29 @@
 #include "differentiable.h"
+#include "tape.h"
+#include "nodefactory.h"
+#include "profiler.h"
 
 #include <algorithm>
 #include <cmath>
 
-Differentiable::Differentiable(double value) : value_(value), derivative_(0) {}
+Differentiable::Differentiable(double value) : value_(value), derivative_(0)
+{
+    Profiler::add(ProfileCounter::nodes_built);
+}
+
+void Differentiable::release_arguments()
+{
+    std::vector<std::shared_ptr<Differentiable>> pending;
+    take_arguments(pending);
+    while (!pending.empty()) {
+        std::shared_ptr<Differentiable> node = std::move(pending.back());
+        pending.pop_back();
+        // the last owner empties the node before it dies, so its destructor has nothing left to recurse into
+        if (node.use_count() == 1) {
+            node->take_arguments(pending);
+        }
+    }
+}
 
 
 double Differentiable::get_value()
@@ -16,44 +36,96 @@ double Differentiable::get_derivative()
     return derivative_;
 }
 
+MultipleMutexGuard Differentiable::lock_all_mutaxes()
+{
+    std::vector<std::shared_ptr<Parameter>> parameters;
+    get_all_parameters(parameters);
+    std::sort(parameters.begin(), parameters.end(), [] (std::shared_ptr<Parameter> a, std::shared_ptr<Parameter> b)
+        {
+            return a->get_name() < b->get_name();
+        });
+
+    std::vector<std::mutex*> mutexes;
+    for (auto x : parameters) {
+        mutexes.push_back(&(x->mut));
+    }
+
+    return MultipleMutexGuard(mutexes);
+}
+
+Grad<double> Differentiable::make_grad(DiffMode mode)
+{
+    std::vector<double> gradient;
+    std::vector<std::shared_ptr<Parameter>> parameters;
+    get_all_parameters(parameters);
+
+    MultipleMutexGuard m = lock_all_mutaxes();
+
+    if (mode == DiffMode::reverse) {
+        std::map<Parameter*, std::size_t> index;
+        for (std::size_t i = 0; i < parameters.size(); ++i) {
+            index[parameters[i].get()] = i;
+        }
+
+        gradient.assign(parameters.size(), 0);
+        operator()();
+        propagate_adjoint(1, index, gradient);
+
+        return Grad(gradient);
+    }
+
+    for (auto x : parameters) {
+        x->make_const();
+    }
+
+    for (auto x : parameters) {
+        x->make_var();
+        operator()();
+        gradient.push_back(derivative_);
+        x->make_const();
+    }
+
+    return Grad(gradient);
+}
+
 std::shared_ptr<Differentiable> operator +(std::shared_ptr<Differentiable> a, std::shared_ptr<Differentiable> b)
 {
-    return std::make_shared<Plus>(a, b);
+    return std::make_shared<Plus>(std::move(a), std::move(b));
 }
 
 std::shared_ptr<Differentiable> operator -(std::shared_ptr<Differentiable> a, std::shared_ptr<Differentiable> b)
 {
-    return std::make_shared<Sub>(a, b);
+    return std::make_shared<Sub>(std::move(a), std::move(b));
 }
 
 std::shared_ptr<Differentiable> operator *(std::shared_ptr<Differentiable> a, std::shared_ptr<Differentiable> b)
 {
-    return std::make_shared<Mul>(a, b);
+    return std::make_shared<Mul>(std::move(a), std::move(b));
 }
 
 std::shared_ptr<Differentiable> operator /(std::shared_ptr<Differentiable> a, std::shared_ptr<Differentiable> b)
 {
-    return std::make_shared<Dev>(a, b);
+    return std::make_shared<Dev>(std::move(a), std::move(b));
 }
 
 std::shared_ptr<Differentiable> operator -(std::shared_ptr<Differentiable> a)
 {
-    return std::make_shared<Neg>(a);
+    return std::make_shared<Neg>(std::move(a));
 }
 
 std::shared_ptr<Differentiable> d_sin(std::shared_ptr<Differentiable> a)
 {
-    return std::make_shared<Sin>(a);
+    return std::make_shared<Sin>(std::move(a));
 }
 
 std::shared_ptr<Differentiable> d_cos(std::shared_ptr<Differentiable> a)
 {
-    return std::make_shared<Cos>(a);
+    return std::make_shared<Cos>(std::move(a));
 }
 
 std::shared_ptr<Differentiable> d_pow(std::shared_ptr<Differentiable> a, std::shared_ptr<Differentiable> n)
 {
-    return std::make_shared<Pow>(a, n);
+    return std::make_shared<Pow>(std::move(a), std::move(n));
 }
 
 
@@ -66,7 +138,7 @@ MultipleMutexGuard Const::lock_all_mutaxes()
     return MultipleMutexGuard(std::vector<std::mutex*>{});
 }
 
-Grad<double> Const::make_grad()
+Grad<double> Const::make_grad(DiffMode /*mode*/)
 {
     return Grad<double>();
 }
@@ -75,11 +147,21 @@ double Const::operator()()
     return value_;
 }
 
+std::size_t Const::compile(Tape& tape)
+{
+    return tape.push_const(value_);
+}
+
+std::shared_ptr<Differentiable> Const::rebuild(NodeFactory& factory)
+{
+    return factory.constant(value_);
+}
+
 
 //Var
 Var::Var(std::string name) : Differentiable(0), parameter_(std::make_shared<Parameter>(0, 1, name)) {}
 
-Var::Var(std::shared_ptr<Parameter> parameter) : Differentiable(parameter->get_value()), parameter_(parameter)
+Var::Var(std::shared_ptr<Parameter> parameter) : Differentiable(parameter->get_value()), parameter_(std::move(parameter))
 {
     derivative_ = parameter_->is_diff();
 }
@@ -95,61 +177,48 @@ void Var::get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters
 }
 
 
-MultipleMutexGuard Var::lock_all_mutaxes()
+double Var::operator()()
 {
-    std::vector<std::shared_ptr<Parameter>> parameters;
-    get_all_parameters(parameters);
-    std::sort(parameters.begin(), parameters.end(), [] (std::shared_ptr<Parameter> a, std::shared_ptr<Parameter> b)
-        {
-            return a->get_name() < b->get_name();
-        });
-
-    std::vector<std::mutex*> mutexes;
-    for (auto x : parameters) {
-        mutexes.push_back(&(x->mut));
-    }
+    value_ = parameter_->get_value();
+    derivative_ = parameter_->is_diff();
 
-    return MultipleMutexGuard(mutexes);
+    return value_;
 }
 
-Grad<double> Var::make_grad()
+void Var::propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient)
 {
-    std::vector<double> gradient;
-    std::vector<std::shared_ptr<Parameter>> parameters;
-    get_all_parameters(parameters);
-
-    MultipleMutexGuard m = lock_all_mutaxes();
-
-    for (auto x : parameters) {
-        x->make_const();
-    }
-
-    for (auto x : parameters) {
-        x->make_var();
-        operator()();
-        gradient.push_back(derivative_);
-        x->make_const();
-    }
-
-    return Grad(gradient);
+    gradient[index.at(parameter_.get())] += adjoint;
 }
 
-double Var::operator()()
+std::size_t Var::compile(Tape& tape)
 {
-    value_ = parameter_->get_value();
-    derivative_ = parameter_->is_diff();
+    return tape.push_var(parameter_);
+}
 
-    return value_;
+std::shared_ptr<Differentiable> Var::rebuild(NodeFactory& factory)
+{
+    return factory.variable(parameter_);
 }
 
 
 //Pow
-Pow::Pow(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> n) : Var("^"), x_(x), n_(n)
+Pow::Pow(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> n) : Differentiable(0), x_(std::move(x)), n_(std::move(n))
 {
     value_ = pow(x_->get_value(), n_->get_value());
     derivative_ = n_->get_value() * pow(x_->get_value(), n_->get_value() - 1) * x_->get_derivative();
 }
 
+Pow::~Pow()
+{
+    release_arguments();
+}
+
+void Pow::take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments)
+{
+    arguments.push_back(std::move(x_));
+    arguments.push_back(std::move(n_));
+}
+
 void Pow::get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters)
 {
     x_->get_all_parameters(parameters);
@@ -165,19 +234,46 @@ double Pow::operator()()
     value_ = pow(x_->get_value(), n_->get_value());
     derivative_ = n_->get_value() * pow(x_->get_value(), n_->get_value() - 1) * x_->get_derivative();
 
-    parameter_->set_value(value_);
-
     return value_;
 }
 
+void Pow::propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient)
+{
+    x_->propagate_adjoint(adjoint * n_->get_value() * pow(x_->get_value(), n_->get_value() - 1), index, gradient);
+}
+
+std::size_t Pow::compile(Tape& tape)
+{
+    std::size_t x = tape.compile(x_);
+    std::size_t n = tape.compile(n_);
+
+    return tape.push(OpCode::pow, x, n);
+}
+
+std::shared_ptr<Differentiable> Pow::rebuild(NodeFactory& factory)
+{
+    return factory.make<Pow>(factory.rebuild(x_), factory.rebuild(n_));
+}
+
 
 //Plus
-Plus::Plus(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y) : Var("+"), x_(x), y_(y)
+Plus::Plus(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y) : Differentiable(0), x_(std::move(x)), y_(std::move(y))
 {
     value_ = x_->get_value() + y_->get_value();
     derivative_ = x_->get_derivative() + y_->get_derivative();
 }
 
+Plus::~Plus()
+{
+    release_arguments();
+}
+
+void Plus::take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments)
+{
+    arguments.push_back(std::move(x_));
+    arguments.push_back(std::move(y_));
+}
+
 void Plus::get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters)
 {
     x_->get_all_parameters(parameters);
@@ -193,19 +289,47 @@ double Plus::operator()()
     value_ = x_->get_value() + y_->get_value();
     derivative_ = x_->get_derivative() + y_->get_derivative();
 
-    parameter_->set_value(value_);
-
     return value_;
 }
 
+void Plus::propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient)
+{
+    x_->propagate_adjoint(adjoint, index, gradient);
+    y_->propagate_adjoint(adjoint, index, gradient);
+}
+
+std::size_t Plus::compile(Tape& tape)
+{
+    std::size_t x = tape.compile(x_);
+    std::size_t y = tape.compile(y_);
+
+    return tape.push(OpCode::plus, x, y);
+}
+
+std::shared_ptr<Differentiable> Plus::rebuild(NodeFactory& factory)
+{
+    return factory.make<Plus>(factory.rebuild(x_), factory.rebuild(y_));
+}
+
 
 //Sub
-Sub::Sub(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y) : Var("-"), x_(x), y_(y)
+Sub::Sub(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y) : Differentiable(0), x_(std::move(x)), y_(std::move(y))
 {
     value_ = x_->get_value() - y_->get_value();
     derivative_ = x_->get_derivative() - y_->get_derivative();
 }
 
+Sub::~Sub()
+{
+    release_arguments();
+}
+
+void Sub::take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments)
+{
+    arguments.push_back(std::move(x_));
+    arguments.push_back(std::move(y_));
+}
+
 void Sub::get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters)
 {
     x_->get_all_parameters(parameters);
@@ -221,19 +345,47 @@ double Sub::operator()()
     value_ = x_->get_value() - y_->get_value();
     derivative_ = x_->get_derivative() - y_->get_derivative();
 
-    parameter_->set_value(value_);
-
     return value_;
 }
 
+void Sub::propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient)
+{
+    x_->propagate_adjoint(adjoint, index, gradient);
+    y_->propagate_adjoint(-adjoint, index, gradient);
+}
+
+std::size_t Sub::compile(Tape& tape)
+{
+    std::size_t x = tape.compile(x_);
+    std::size_t y = tape.compile(y_);
+
+    return tape.push(OpCode::sub, x, y);
+}
+
+std::shared_ptr<Differentiable> Sub::rebuild(NodeFactory& factory)
+{
+    return factory.make<Sub>(factory.rebuild(x_), factory.rebuild(y_));
+}
+
 
 //Mul
-Mul::Mul(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y) : Var("*"), x_(x), y_(y)
+Mul::Mul(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y) : Differentiable(0), x_(std::move(x)), y_(std::move(y))
 {
     value_ = x_->get_value() * y_->get_value();
     derivative_ = x_->get_value() * y_->get_derivative() + x_->get_derivative() * y_->get_value();
 }
 
+Mul::~Mul()
+{
+    release_arguments();
+}
+
+void Mul::take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments)
+{
+    arguments.push_back(std::move(x_));
+    arguments.push_back(std::move(y_));
+}
+
 void Mul::get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters)
 {
     x_->get_all_parameters(parameters);
@@ -249,19 +401,47 @@ double Mul::operator()()
     value_ = x_->get_value() * y_->get_value();
     derivative_ = x_->get_value() * y_->get_derivative() + x_->get_derivative() * y_->get_value();
 
-    parameter_->set_value(value_);
-
     return value_;
 }
 
+void Mul::propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient)
+{
+    x_->propagate_adjoint(adjoint * y_->get_value(), index, gradient);
+    y_->propagate_adjoint(adjoint * x_->get_value(), index, gradient);
+}
+
+std::size_t Mul::compile(Tape& tape)
+{
+    std::size_t x = tape.compile(x_);
+    std::size_t y = tape.compile(y_);
+
+    return tape.push(OpCode::mul, x, y);
+}
+
+std::shared_ptr<Differentiable> Mul::rebuild(NodeFactory& factory)
+{
+    return factory.make<Mul>(factory.rebuild(x_), factory.rebuild(y_));
+}
+
 
 //Dev
-Dev::Dev(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y) : Var("/"), x_(x), y_(y)
+Dev::Dev(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y) : Differentiable(0), x_(std::move(x)), y_(std::move(y))
 {
     value_ = x_->get_value() / y_->get_value();
     derivative_ = (x_->get_derivative() * y_->get_value() - x_->get_value() * y_->get_derivative()) / (y_->get_value() * y_->get_value());
 }
 
+Dev::~Dev()
+{
+    release_arguments();
+}
+
+void Dev::take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments)
+{
+    arguments.push_back(std::move(x_));
+    arguments.push_back(std::move(y_));
+}
+
 void Dev::get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters)
 {
     x_->get_all_parameters(parameters);
@@ -277,19 +457,46 @@ double Dev::operator()()
     value_ = x_->get_value() / y_->get_value();
     derivative_ = (x_->get_derivative() * y_->get_value() - x_->get_value() * y_->get_derivative()) / (y_->get_value() * y_->get_value());
 
-    parameter_->set_value(value_);
-
     return value_;
 }
 
+void Dev::propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient)
+{
+    x_->propagate_adjoint(adjoint / y_->get_value(), index, gradient);
+    y_->propagate_adjoint(-adjoint * x_->get_value() / (y_->get_value() * y_->get_value()), index, gradient);
+}
+
+std::size_t Dev::compile(Tape& tape)
+{
+    std::size_t x = tape.compile(x_);
+    std::size_t y = tape.compile(y_);
+
+    return tape.push(OpCode::dev, x, y);
+}
+
+std::shared_ptr<Differentiable> Dev::rebuild(NodeFactory& factory)
+{
+    return factory.make<Dev>(factory.rebuild(x_), factory.rebuild(y_));
+}
+
 
 //Cos
-Cos::Cos(std::shared_ptr<Differentiable> x) : Var("cos"), x_(x)
+Cos::Cos(std::shared_ptr<Differentiable> x) : Differentiable(0), x_(std::move(x))
 {
     value_ = std::cos(x_->get_value());
     derivative_ = -std::sin(x_->get_value()) * x_->get_derivative();
 }
 
+Cos::~Cos()
+{
+    release_arguments();
+}
+
+void Cos::take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments)
+{
+    arguments.push_back(std::move(x_));
+}
+
 void Cos::get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters)
 {
     x_->get_all_parameters(parameters);
@@ -303,19 +510,44 @@ double Cos::operator()()
     value_ = std::cos(x_->get_value());
     derivative_ = -std::sin(x_->get_value()) * x_->get_derivative();
 
-    parameter_->set_value(value_);
-
     return value_;
 }
 
+void Cos::propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient)
+{
+    x_->propagate_adjoint(-adjoint * std::sin(x_->get_value()), index, gradient);
+}
+
+std::size_t Cos::compile(Tape& tape)
+{
+    std::size_t x = tape.compile(x_);
+
+    return tape.push(OpCode::cos, x);
+}
+
+std::shared_ptr<Differentiable> Cos::rebuild(NodeFactory& factory)
+{
+    return factory.make<Cos>(factory.rebuild(x_));
+}
+
 
 //Sin
-Sin::Sin(std::shared_ptr<Differentiable> x) : Var("sin"), x_(x)
+Sin::Sin(std::shared_ptr<Differentiable> x) : Differentiable(0), x_(std::move(x))
 {
     value_ = std::sin(x_->get_value());
     derivative_ = std::cos(x_->get_value()) * x_->get_derivative();
 }
 
+Sin::~Sin()
+{
+    release_arguments();
+}
+
+void Sin::take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments)
+{
+    arguments.push_back(std::move(x_));
+}
+
 void Sin::get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters)
 {
     x_->get_all_parameters(parameters);
@@ -329,19 +561,44 @@ double Sin::operator()()
     value_ = std::sin(x_->get_value());
     derivative_ = std::cos(x_->get_value()) * x_->get_derivative();
 
-    parameter_->set_value(value_);
-
     return value_;
 }
 
+void Sin::propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient)
+{
+    x_->propagate_adjoint(adjoint * std::cos(x_->get_value()), index, gradient);
+}
+
+std::size_t Sin::compile(Tape& tape)
+{
+    std::size_t x = tape.compile(x_);
+
+    return tape.push(OpCode::sin, x);
+}
+
+std::shared_ptr<Differentiable> Sin::rebuild(NodeFactory& factory)
+{
+    return factory.make<Sin>(factory.rebuild(x_));
+}
+
 
 //Neg
-Neg::Neg(std::shared_ptr<Differentiable> x) : Var("-"), x_(x)
+Neg::Neg(std::shared_ptr<Differentiable> x) : Differentiable(0), x_(std::move(x))
 {
     value_ = -x_->get_value();
     derivative_ = -x_->get_derivative();
 }
 
+Neg::~Neg()
+{
+    release_arguments();
+}
+
+void Neg::take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments)
+{
+    arguments.push_back(std::move(x_));
+}
+
 void Neg::get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters)
 {
     x_->get_all_parameters(parameters);
@@ -355,7 +612,22 @@ double Neg::operator()()
     value_ = -x_->get_value();
     derivative_ = -x_->get_derivative();
 
-    parameter_->set_value(value_);
-
     return value_;
 }
+
+void Neg::propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient)
+{
+    x_->propagate_adjoint(-adjoint, index, gradient);
+}
+
+std::size_t Neg::compile(Tape& tape)
+{
+    std::size_t x = tape.compile(x_);
+
+    return tape.push(OpCode::neg, x);
+}
+
+std::shared_ptr<Differentiable> Neg::rebuild(NodeFactory& factory)
+{
+    return factory.make<Neg>(factory.rebuild(x_));
+}
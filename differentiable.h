@@ -8,9 +8,18 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <map>
 
 #define CONST(x) std::make_shared<Const>(x)
 
+class Tape;
+class NodeFactory;
+
+enum class DiffMode
+{
+    forward, // one pass per parameter
+    reverse  // one forward and one backward pass for all parameters
+};
 
 class Differentiable
 {
@@ -25,9 +34,15 @@ public:
     double get_derivative();
 
     virtual void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) = 0;
-    virtual MultipleMutexGuard lock_all_mutaxes() = 0;
-    virtual Grad<double> make_grad() = 0;
+    virtual MultipleMutexGuard lock_all_mutaxes();
+    virtual Grad<double> make_grad(DiffMode mode = DiffMode::forward);
     virtual double operator()() = 0;
+    // adds adjoint * d(this)/d(parameter) to gradient[index[parameter]], expects values from the last operator()()
+    virtual void propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient) = 0;
+    // appends the node after its arguments and returns its slot on the tape
+    virtual std::size_t compile(Tape& tape) = 0;
+    // the same node made by factory from the rebuilt arguments, see NodeFactory::rebuild
+    virtual std::shared_ptr<Differentiable> rebuild(NodeFactory& factory) = 0;
 
     friend std::shared_ptr<Differentiable> operator +(std::shared_ptr<Differentiable> a, std::shared_ptr<Differentiable> b);
     friend std::shared_ptr<Differentiable> operator -(std::shared_ptr<Differentiable> a, std::shared_ptr<Differentiable> b);
@@ -38,6 +53,12 @@ public:
     friend std::shared_ptr<Differentiable> d_cos(std::shared_ptr<Differentiable> a);
     friend std::shared_ptr<Differentiable> d_pow(std::shared_ptr<Differentiable> a, std::shared_ptr<Differentiable> n);
 
+protected:
+    // moves the arguments of the node into arguments
+    virtual void take_arguments(std::vector<std::shared_ptr<Differentiable>>& /*arguments*/) {}
+    // called by the destructors of the functions: arguments owned only by this node are taken apart one at a time,
+    // a deep chain like the long sums of the parser would otherwise recurse once per node through ~shared_ptr
+    void release_arguments();
 };
 
 
@@ -49,8 +70,11 @@ public:
 
     void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) override {/*Empty*/}
     MultipleMutexGuard lock_all_mutaxes() override;
-    Grad<double> make_grad() override;
+    Grad<double> make_grad(DiffMode mode = DiffMode::forward) override;
     double operator()() override;
+    void propagate_adjoint(double /*adjoint*/, const std::map<Parameter*, std::size_t>& /*index*/, std::vector<double>& /*gradient*/) override {/*Empty*/}
+    std::size_t compile(Tape& tape) override;
+    std::shared_ptr<Differentiable> rebuild(NodeFactory& factory) override;
 };
 
 class Var : public Differentiable
@@ -61,98 +85,147 @@ public:
     Var(std::string name);
     Var(std::shared_ptr<Parameter> parameter);
 
-    virtual void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) override;
-    MultipleMutexGuard lock_all_mutaxes() override;
-    Grad<double> make_grad() override;
-    virtual double operator()() override;
+    void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) override;
+    double operator()() override;
+    void propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient) override;
+    std::size_t compile(Tape& tape) override;
+    std::shared_ptr<Differentiable> rebuild(NodeFactory& factory) override;
 };
 
 
-//Functions
+//Functions: intermediate results, no Parameter behind them
 
-class Pow : public Var
+class Pow : public Differentiable
 {
     std::shared_ptr<Differentiable> x_;
     std::shared_ptr<Differentiable> n_;
 public:
     Pow(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> n);
+    ~Pow() override;
 
     void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) override;
     double operator()() override;
+    void propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient) override;
+    std::size_t compile(Tape& tape) override;
+    std::shared_ptr<Differentiable> rebuild(NodeFactory& factory) override;
+protected:
+    void take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments) override;
 };
 
-class Plus : public Var
+class Plus : public Differentiable
 {
     std::shared_ptr<Differentiable> x_;
     std::shared_ptr<Differentiable> y_;
 public:
     Plus(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y);
+    ~Plus() override;
 
     void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) override;
     double operator()() override;
+    void propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient) override;
+    std::size_t compile(Tape& tape) override;
+    std::shared_ptr<Differentiable> rebuild(NodeFactory& factory) override;
+protected:
+    void take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments) override;
 };
 
-class Sub : public Var
+class Sub : public Differentiable
 {
     std::shared_ptr<Differentiable> x_;
     std::shared_ptr<Differentiable> y_;
 public:
     Sub(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y);
+    ~Sub() override;
 
     void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) override;
     double operator()() override;
+    void propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient) override;
+    std::size_t compile(Tape& tape) override;
+    std::shared_ptr<Differentiable> rebuild(NodeFactory& factory) override;
+protected:
+    void take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments) override;
 };
 
-class Mul : public Var
+class Mul : public Differentiable
 {
     std::shared_ptr<Differentiable> x_;
     std::shared_ptr<Differentiable> y_;
 public:
     Mul(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y);
+    ~Mul() override;
 
     void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) override;
     double operator()() override;
+    void propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient) override;
+    std::size_t compile(Tape& tape) override;
+    std::shared_ptr<Differentiable> rebuild(NodeFactory& factory) override;
+protected:
+    void take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments) override;
 };
 
-class Dev : public Var
+class Dev : public Differentiable
 {
     std::shared_ptr<Differentiable> x_;
     std::shared_ptr<Differentiable> y_;
 public:
     Dev(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y);
+    ~Dev() override;
 
     void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) override;
     double operator()() override;
+    void propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient) override;
+    std::size_t compile(Tape& tape) override;
+    std::shared_ptr<Differentiable> rebuild(NodeFactory& factory) override;
+protected:
+    void take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments) override;
 };
 
-class Cos : public Var
+class Cos : public Differentiable
 {
     std::shared_ptr<Differentiable> x_;
 public:
     Cos(std::shared_ptr<Differentiable> x);
+    ~Cos() override;
 
     void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) override;
     double operator()() override;
+    void propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient) override;
+    std::size_t compile(Tape& tape) override;
+    std::shared_ptr<Differentiable> rebuild(NodeFactory& factory) override;
+protected:
+    void take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments) override;
 };
 
-class Sin : public Var
+class Sin : public Differentiable
 {
     std::shared_ptr<Differentiable> x_;
 public:
     Sin(std::shared_ptr<Differentiable> x);
+    ~Sin() override;
 
     void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) override;
     double operator()() override;
+    void propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient) override;
+    std::size_t compile(Tape& tape) override;
+    std::shared_ptr<Differentiable> rebuild(NodeFactory& factory) override;
+protected:
+    void take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments) override;
 };
 
-class Neg : public Var
+class Neg : public Differentiable
 {
     std::shared_ptr<Differentiable> x_;
 public:
     Neg(std::shared_ptr<Differentiable> x);
+    ~Neg() override;
 
     void get_all_parameters(std::vector<std::shared_ptr<Parameter>>& parameters) override;
     double operator()() override;
+    void propagate_adjoint(double adjoint, const std::map<Parameter*, std::size_t>& index, std::vector<double>& gradient) override;
+    std::size_t compile(Tape& tape) override;
+    std::shared_ptr<Differentiable> rebuild(NodeFactory& factory) override;
+protected:
+    void take_arguments(std::vector<std::shared_ptr<Differentiable>>& arguments) override;
 };
 
 #endif // DIFFERENTIABLE_H
@@ -1,83 +1,276 @@
 #ifndef GRAD_H
 #define GRAD_H
 
+#include "gradkernels.h"
+
 #include <vector>
+#include <type_traits>
+#include <cstddef>
+#include <utility>
 
+// Non-owning window over a contiguous buffer with the in-place operations of Grad.
+// Operations never allocate, the sizes of both operands must match.
+// For double the loops go to the vectorized kernels of gradkernels.h.
 template<typename Num>
-class Grad
+class GradView
 {
-    std::vector<Num> val_;
+    Num *val_;
+    std::size_t size_;
 public:
-    Grad(std::vector<Num> val = {0.0}) : val_(val) {}
-    const Grad& operator=(const Grad &other)
+    using value_type = std::remove_const_t<Num>;
+
+    GradView(Num *val, std::size_t size) : val_(val), size_(size) {}
+
+    template<typename Other, typename = std::enable_if_t<std::is_convertible_v<Other*, Num*>>>
+    GradView(GradView<Other> other) : val_(other.data()), size_(other.size()) {}
+
+    Num& operator[](std::size_t i) const
+    {
+        return val_[i];
+    }
+
+    Num* data() const
+    {
+        return val_;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    void assign(GradView<const value_type> other)
     {
-        val_ = other.val_;
+        for (std::size_t i = 0; i < size_; ++i) {
+            val_[i] = other[i];
+        }
+    }
+
+    GradView& operator+=(GradView<const value_type> other)
+    {
+        if constexpr (std::is_same_v<value_type, double>) {
+            axpy_kernel(val_, 1, other.data(), size_);
+            return *this;
+        }
+
+        for (std::size_t i = 0; i < size_; ++i) {
+            val_[i] += other[i];
+        }
+
         return *this;
     }
 
-    Num& operator[](std::size_t i)
+    GradView& operator-=(GradView<const value_type> other)
     {
-        return val_[i];
+        if constexpr (std::is_same_v<value_type, double>) {
+            axpy_kernel(val_, -1, other.data(), size_);
+            return *this;
+        }
+
+        for (std::size_t i = 0; i < size_; ++i) {
+            val_[i] -= other[i];
+        }
+
+        return *this;
     }
 
-    Grad<Num> operator+(const Grad &other) const
+    GradView& operator*=(value_type a)
     {
-        std::vector<Num> new_val = val_;
-        for (int i = 0; i < new_val.size(); ++i) {
-            new_val[i] += other.val_[i];
+        if constexpr (std::is_same_v<value_type, double>) {
+            scale_kernel(val_, a, size_);
+            return *this;
         }
 
-        return Grad(new_val);
+        for (std::size_t i = 0; i < size_; ++i) {
+            val_[i] *= a;
+        }
+
+        return *this;
     }
 
-    Grad<Num> operator-(const Grad &other) const
+    GradView& operator/=(value_type a)
     {
-        std::vector<Num> new_val = val_;
-        for (int i = 0; i < new_val.size(); ++i) {
-            new_val[i] -= other.val_[i];
+        for (std::size_t i = 0; i < size_; ++i) {
+            val_[i] /= a;
         }
 
-        return Grad(new_val);
+        return *this;
     }
 
-    Grad<Num> operator*(Num a) const
+    // this += a * x
+    GradView& axpy(value_type a, GradView<const value_type> x)
     {
-        std::vector<Num> new_val = val_;
-        for (int i = 0; i < new_val.size(); ++i) {
-            new_val[i] *= a;
+        if constexpr (std::is_same_v<value_type, double>) {
+            axpy_kernel(val_, a, x.data(), size_);
+            return *this;
+        }
+
+        for (std::size_t i = 0; i < size_; ++i) {
+            val_[i] += a * x[i];
         }
 
-        return Grad(new_val);
+        return *this;
     }
 
-    Grad<Num> operator/(Num a) const
+    // this = a * x + b * this
+    GradView& axpby(value_type a, GradView<const value_type> x, value_type b)
     {
-        std::vector<Num> new_val = val_;
-        for (int i = 0; i < new_val.size(); ++i) {
-            new_val[i] /= a;
+        if constexpr (std::is_same_v<value_type, double>) {
+            axpby_kernel(val_, a, x.data(), b, size_);
+            return *this;
+        }
+
+        for (std::size_t i = 0; i < size_; ++i) {
+            val_[i] = a * x[i] + b * val_[i];
         }
 
-        return Grad(new_val);
+        return *this;
     }
 
-    Num operator*(const Grad &other)
+    value_type operator*(GradView<const value_type> other) const
     {
-        Num len = 0;
-        for (int i = 0; i < val_.size(); ++i) {
-            len += val_[i] * other.val_[i];
+        if constexpr (std::is_same_v<value_type, double>) {
+            return dot_kernel(val_, other.data(), size_);
+        }
+
+        value_type len = 0;
+        for (std::size_t i = 0; i < size_; ++i) {
+            len += val_[i] * other[i];
         }
 
         return len;
     }
+};
+
+template<typename Num>
+class Grad
+{
+    std::vector<Num> val_;
+public:
+    Grad(std::vector<Num> val = {0.0}) : val_(std::move(val)) {}
+    Grad(const Grad &other) = default;
+    Grad(Grad &&other) = default;
+    Grad& operator=(Grad &&other) = default;
+    const Grad& operator=(const Grad &other)
+    {
+        val_ = other.val_; // reuses the buffer when sizes match
+        return *this;
+    }
 
-    Grad<Num> operator-()
+    Num& operator[](std::size_t i)
     {
-        std::vector<Num> new_val = val_;
-        for (int i = 0; i < new_val.size(); ++i) {
-            new_val[i] *= -1;
-        }
+        return val_[i];
+    }
 
-        return Grad(new_val);
+    const Num& operator[](std::size_t i) const
+    {
+        return val_[i];
+    }
+
+    std::size_t size() const
+    {
+        return val_.size();
+    }
+
+    void resize(std::size_t size)
+    {
+        val_.resize(size);
+    }
+
+    GradView<Num> view()
+    {
+        return GradView<Num>(val_.data(), val_.size());
+    }
+
+    GradView<const Num> view() const
+    {
+        return GradView<const Num>(val_.data(), val_.size());
+    }
+
+    operator GradView<Num>()
+    {
+        return view();
+    }
+
+    operator GradView<const Num>() const
+    {
+        return view();
+    }
+
+    Grad& operator+=(const Grad &other)
+    {
+        view() += other.view();
+        return *this;
+    }
+
+    Grad& operator-=(const Grad &other)
+    {
+        view() -= other.view();
+        return *this;
+    }
+
+    Grad& operator*=(Num a)
+    {
+        view() *= a;
+        return *this;
+    }
+
+    Grad& operator/=(Num a)
+    {
+        view() /= a;
+        return *this;
+    }
+
+    Grad& axpy(Num a, const Grad &x)
+    {
+        view().axpy(a, x.view());
+        return *this;
+    }
+
+    Grad& axpby(Num a, const Grad &x, Num b)
+    {
+        view().axpby(a, x.view(), b);
+        return *this;
+    }
+
+    Grad<Num> operator+(const Grad &other) const
+    {
+        Grad<Num> result = *this;
+        result += other;
+        return result;
+    }
+
+    Grad<Num> operator-(const Grad &other) const
+    {
+        Grad<Num> result = *this;
+        result -= other;
+        return result;
+    }
+
+    Grad<Num> operator*(Num a) const
+    {
+        Grad<Num> result = *this;
+        result *= a;
+        return result;
+    }
+
+    Grad<Num> operator/(Num a) const
+    {
+        Grad<Num> result = *this;
+        result /= a;
+        return result;
+    }
+
+    Num operator*(const Grad &other) const
+    {
+        return view() * other.view();
+    }
+
+    Grad<Num> operator-() const
+    {
+        Grad<Num> result = *this;
+        result *= -1;
+        return result;
     }
 };
 
@@ -0,0 +1,348 @@
+#include "gradkernels.h"
+
+#include <cmath>
+#include <atomic>
+#include <initializer_list>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GRAD_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+
+namespace {
+
+struct Kernels
+{
+    KernelIsa isa;
+    double (*dot)(const double*, const double*, std::size_t);
+    void (*scale)(double*, double, std::size_t);
+    void (*axpy)(double*, double, const double*, std::size_t);
+    void (*axpby)(double*, double, const double*, double, std::size_t);
+    void (*adam)(double*, double*, double*, const double*, std::size_t, double, double, double, double, double);
+};
+
+
+//Scalar
+double dot_scalar(const double *x, const double *y, std::size_t n)
+{
+    double len = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        len += x[i] * y[i];
+    }
+
+    return len;
+}
+
+void scale_scalar(double *x, double a, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        x[i] *= a;
+    }
+}
+
+void axpy_scalar(double *y, double a, const double *x, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        y[i] += a * x[i];
+    }
+}
+
+void axpby_scalar(double *y, double a, const double *x, double b, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        y[i] = a * x[i] + b * y[i];
+    }
+}
+
+void adam_scalar(double *step, double *m, double *v, const double *g, std::size_t n,
+                 double beta_1, double beta_2, double lr_t, double v_correction, double eps)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        m[i] = beta_1 * m[i] + (1 - beta_1) * g[i];
+        v[i] = beta_2 * v[i] + (1 - beta_2) * g[i] * g[i];
+        step[i] = -lr_t * m[i] / (std::sqrt(v[i] * v_correction) + eps);
+    }
+}
+
+constexpr Kernels scalar_kernels{KernelIsa::scalar, dot_scalar, scale_scalar, axpy_scalar, axpby_scalar, adam_scalar};
+
+
+#ifdef GRAD_KERNELS_X86
+
+//AVX2
+__attribute__((target("avx2,fma")))
+double dot_avx2(const double *x, const double *y, std::size_t n)
+{
+    __m256d acc_1 = _mm256_setzero_pd();
+    __m256d acc_2 = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc_1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), acc_1);
+        acc_2 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4), acc_2);
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc_1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), acc_1);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc_1, acc_2));
+    double len = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    return len + dot_scalar(x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+void scale_avx2(double *x, double a, std::size_t n)
+{
+    const __m256d va = _mm256_set1_pd(a);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(x + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), va));
+    }
+
+    scale_scalar(x + i, a, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+void axpy_avx2(double *y, double a, const double *x, std::size_t n)
+{
+    const __m256d va = _mm256_set1_pd(a);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    }
+
+    axpy_scalar(y + i, a, x + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+void axpby_avx2(double *y, double a, const double *x, double b, std::size_t n)
+{
+    const __m256d va = _mm256_set1_pd(a);
+    const __m256d vb = _mm256_set1_pd(b);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_mul_pd(vb, _mm256_loadu_pd(y + i))));
+    }
+
+    axpby_scalar(y + i, a, x + i, b, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+void adam_avx2(double *step, double *m, double *v, const double *g, std::size_t n,
+               double beta_1, double beta_2, double lr_t, double v_correction, double eps)
+{
+    const __m256d b1 = _mm256_set1_pd(beta_1);
+    const __m256d c1 = _mm256_set1_pd(1 - beta_1);
+    const __m256d b2 = _mm256_set1_pd(beta_2);
+    const __m256d c2 = _mm256_set1_pd(1 - beta_2);
+    const __m256d lr = _mm256_set1_pd(-lr_t);
+    const __m256d vc = _mm256_set1_pd(v_correction);
+    const __m256d ve = _mm256_set1_pd(eps);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256d vg = _mm256_loadu_pd(g + i);
+        const __m256d vm = _mm256_fmadd_pd(b1, _mm256_loadu_pd(m + i), _mm256_mul_pd(c1, vg));
+        const __m256d vv = _mm256_fmadd_pd(b2, _mm256_loadu_pd(v + i), _mm256_mul_pd(c2, _mm256_mul_pd(vg, vg)));
+        const __m256d denom = _mm256_add_pd(_mm256_sqrt_pd(_mm256_mul_pd(vv, vc)), ve);
+        _mm256_storeu_pd(m + i, vm);
+        _mm256_storeu_pd(v + i, vv);
+        _mm256_storeu_pd(step + i, _mm256_div_pd(_mm256_mul_pd(lr, vm), denom));
+    }
+
+    adam_scalar(step + i, m + i, v + i, g + i, n - i, beta_1, beta_2, lr_t, v_correction, eps);
+}
+
+constexpr Kernels avx2_kernels{KernelIsa::avx2, dot_avx2, scale_avx2, axpy_avx2, axpby_avx2, adam_avx2};
+
+
+//AVX-512
+__attribute__((target("avx512f")))
+double dot_avx512(const double *x, const double *y, std::size_t n)
+{
+    __m512d acc_1 = _mm512_setzero_pd();
+    __m512d acc_2 = _mm512_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc_1 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i), acc_1);
+        acc_2 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i + 8), _mm512_loadu_pd(y + i + 8), acc_2);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc_1 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i), acc_1);
+    }
+
+    // through memory as in the AVX2 path: _mm512_reduce_add_pd of GCC 12 trips -Wuninitialized in its header
+    double lanes[8];
+    _mm512_storeu_pd(lanes, _mm512_add_pd(acc_1, acc_2));
+    double len = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+
+    return len + dot_scalar(x + i, y + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+void scale_avx512(double *x, double a, std::size_t n)
+{
+    const __m512d va = _mm512_set1_pd(a);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm512_storeu_pd(x + i, _mm512_mul_pd(_mm512_loadu_pd(x + i), va));
+    }
+
+    scale_scalar(x + i, a, n - i);
+}
+
+__attribute__((target("avx512f")))
+void axpy_avx512(double *y, double a, const double *x, std::size_t n)
+{
+    const __m512d va = _mm512_set1_pd(a);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm512_storeu_pd(y + i, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i)));
+    }
+
+    axpy_scalar(y + i, a, x + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+void axpby_avx512(double *y, double a, const double *x, double b, std::size_t n)
+{
+    const __m512d va = _mm512_set1_pd(a);
+    const __m512d vb = _mm512_set1_pd(b);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm512_storeu_pd(y + i, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + i), _mm512_mul_pd(vb, _mm512_loadu_pd(y + i))));
+    }
+
+    axpby_scalar(y + i, a, x + i, b, n - i);
+}
+
+__attribute__((target("avx512f")))
+void adam_avx512(double *step, double *m, double *v, const double *g, std::size_t n,
+                 double beta_1, double beta_2, double lr_t, double v_correction, double eps)
+{
+    const __m512d b1 = _mm512_set1_pd(beta_1);
+    const __m512d c1 = _mm512_set1_pd(1 - beta_1);
+    const __m512d b2 = _mm512_set1_pd(beta_2);
+    const __m512d c2 = _mm512_set1_pd(1 - beta_2);
+    const __m512d lr = _mm512_set1_pd(-lr_t);
+    const __m512d vc = _mm512_set1_pd(v_correction);
+    const __m512d ve = _mm512_set1_pd(eps);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m512d vg = _mm512_loadu_pd(g + i);
+        const __m512d vm = _mm512_fmadd_pd(b1, _mm512_loadu_pd(m + i), _mm512_mul_pd(c1, vg));
+        const __m512d vv = _mm512_fmadd_pd(b2, _mm512_loadu_pd(v + i), _mm512_mul_pd(c2, _mm512_mul_pd(vg, vg)));
+        // the zero-masked form with every lane set, the plain one reads _mm512_undefined_pd and warns with GCC 12
+        const __m512d denom = _mm512_add_pd(_mm512_maskz_sqrt_pd(0xff, _mm512_mul_pd(vv, vc)), ve);
+        _mm512_storeu_pd(m + i, vm);
+        _mm512_storeu_pd(v + i, vv);
+        _mm512_storeu_pd(step + i, _mm512_div_pd(_mm512_mul_pd(lr, vm), denom));
+    }
+
+    adam_scalar(step + i, m + i, v + i, g + i, n - i, beta_1, beta_2, lr_t, v_correction, eps);
+}
+
+constexpr Kernels avx512_kernels{KernelIsa::avx512, dot_avx512, scale_avx512, axpy_avx512, axpby_avx512, adam_avx512};
+
+#endif // GRAD_KERNELS_X86
+
+
+bool supported(KernelIsa isa)
+{
+#ifdef GRAD_KERNELS_X86
+    __builtin_cpu_init();
+    switch (isa) {
+    case KernelIsa::scalar:
+        return true;
+    case KernelIsa::avx2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case KernelIsa::avx512:
+        return __builtin_cpu_supports("avx512f");
+    }
+    return false;
+#else
+    return isa == KernelIsa::scalar;
+#endif
+}
+
+const Kernels* kernels_for(KernelIsa isa)
+{
+#ifdef GRAD_KERNELS_X86
+    if (isa == KernelIsa::avx512) {
+        return &avx512_kernels;
+    }
+    if (isa == KernelIsa::avx2) {
+        return &avx2_kernels;
+    }
+#endif
+    return &scalar_kernels;
+}
+
+const Kernels* best_kernels()
+{
+    for (KernelIsa isa : {KernelIsa::avx512, KernelIsa::avx2}) {
+        if (supported(isa)) {
+            return kernels_for(isa);
+        }
+    }
+
+    return &scalar_kernels;
+}
+
+std::atomic<const Kernels*> active{nullptr};
+
+const Kernels& kernels()
+{
+    const Kernels *k = active.load(std::memory_order_relaxed);
+    if (k == nullptr) {
+        k = best_kernels();
+        active.store(k, std::memory_order_relaxed);
+    }
+
+    return *k;
+}
+
+} // namespace
+
+
+KernelIsa kernel_isa()
+{
+    return kernels().isa;
+}
+
+bool set_kernel_isa(KernelIsa isa)
+{
+    if (!supported(isa)) {
+        return false;
+    }
+
+    active.store(kernels_for(isa), std::memory_order_relaxed);
+    return true;
+}
+
+double dot_kernel(const double *x, const double *y, std::size_t n)
+{
+    return kernels().dot(x, y, n);
+}
+
+void scale_kernel(double *x, double a, std::size_t n)
+{
+    kernels().scale(x, a, n);
+}
+
+void axpy_kernel(double *y, double a, const double *x, std::size_t n)
+{
+    kernels().axpy(y, a, x, n);
+}
+
+void axpby_kernel(double *y, double a, const double *x, double b, std::size_t n)
+{
+    kernels().axpby(y, a, x, b, n);
+}
+
+void adam_kernel(double *step, double *m, double *v, const double *g, std::size_t n,
+                 double beta_1, double beta_2, double lr_t, double v_correction, double eps)
+{
+    kernels().adam(step, m, v, g, n, beta_1, beta_2, lr_t, v_correction, eps);
+}
@@ -0,0 +1,35 @@
+#ifndef GRADKERNELS_H
+#define GRADKERNELS_H
+
+#include <cstddef>
+
+// Element loops over contiguous double buffers. The instruction set is picked once at
+// the first call from what the processor supports, the scalar version works everywhere.
+// Loads and stores are unaligned on purpose: GradView windows into any buffer, like points,
+// rows of batch gradients and subranges, so no alignment can be promised, and on aligned
+// data the unaligned instructions cost the same on current x86 processors.
+
+enum class KernelIsa
+{
+    scalar,
+    avx2,
+    avx512
+};
+
+KernelIsa kernel_isa();
+// returns false and keeps the current kernels if the processor does not support isa
+bool set_kernel_isa(KernelIsa isa);
+
+double dot_kernel(const double *x, const double *y, std::size_t n);
+// x *= a
+void scale_kernel(double *x, double a, std::size_t n);
+// y += a * x
+void axpy_kernel(double *y, double a, const double *x, std::size_t n);
+// y = a * x + b * y
+void axpby_kernel(double *y, double a, const double *x, double b, std::size_t n);
+// per-coordinate Adam: m = beta_1 * m + (1 - beta_1) * g, v = beta_2 * v + (1 - beta_2) * g * g,
+// step = -lr_t * m / (sqrt(v * v_correction) + eps), the bias corrections are folded into lr_t and v_correction
+void adam_kernel(double *step, double *m, double *v, const double *g, std::size_t n,
+                 double beta_1, double beta_2, double lr_t, double v_correction, double eps);
+
+#endif // GRADKERNELS_H
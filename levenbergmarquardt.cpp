@@ -0,0 +1,157 @@
+#include "levenbergmarquardt.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+
+LevenbergMarquardt::LevenbergMarquardt(std::shared_ptr<const Residuals> residuals, std::vector<double> start, double lambda, int max_iterations)
+    : residuals_(std::move(residuals)), state_(residuals_->make_state()), lambda_(lambda), max_iterations_(max_iterations)
+{
+    parameters = residuals_->get_parameters();
+    if (!start.empty()) {
+        if (start.size() != parameters.size()) {
+            throw std::string{"invalid start point"};
+        }
+        state_.point = std::move(start);
+    }
+}
+
+double LevenbergMarquardt::get_loss()
+{
+    return loss;
+}
+
+bool LevenbergMarquardt::is_solved()
+{
+    return loss <= max_loss;
+}
+
+const std::vector<double>& LevenbergMarquardt::get_solution()
+{
+    return state_.point;
+}
+
+void LevenbergMarquardt::write_parameters()
+{
+    for (std::size_t i = 0; i < parameters.size(); ++i) {
+        parameters[i]->set_value(state_.point[i]);
+    }
+}
+
+void LevenbergMarquardt::set_stop_flag(const std::atomic<bool> *stop)
+{
+    stop_ = stop;
+}
+
+void LevenbergMarquardt::operator()()
+{
+    const std::size_t n = parameters.size();
+    const std::size_t m = residuals_->size();
+
+    // all buffers are allocated once, the loop itself works in place
+    SparseMatrix jacobian = residuals_->pattern();
+    Grad<double> r(std::vector<double>(m, 0));
+    Grad<double> trial_r(std::vector<double>(m, 0));
+    Grad<double> jp(std::vector<double>(m, 0));
+    Grad<double> g(std::vector<double>(n, 0));
+    Grad<double> d(std::vector<double>(n, 0));
+    Grad<double> step(std::vector<double>(n, 0));
+    std::vector<double> trial(n, 0);
+    Grad<double> cg_r(std::vector<double>(n, 0));
+    Grad<double> cg_p(std::vector<double>(n, 0));
+    Grad<double> cg_ap(std::vector<double>(n, 0));
+
+    residuals_->jacobian(state_, r.view().data(), jacobian);
+    loss = r * r;
+
+    double mu = -1;
+    double nu = 2;
+    for (int t = 0; ; ++t) {
+        if (loss <= max_loss || t >= max_iterations_ || (stop_ && stop_->load(std::memory_order_relaxed))) {
+            return;
+        }
+        Profiler::add(ProfileCounter::iterations);
+
+        // g = -J^T r, d = diag(J^T J)
+        jacobian.multiply_transposed(r.view().data(), g.view().data());
+        g *= -1;
+        d *= 0;
+        for (std::size_t k = 0; k < jacobian.columns.size(); ++k) {
+            d[jacobian.columns[k]] += jacobian.values[k] * jacobian.values[k];
+        }
+
+        double max_d = 0;
+        for (std::size_t j = 0; j < n; ++j) {
+            max_d = std::max(max_d, d[j]);
+        }
+        if (g * g == 0 || max_d == 0) {
+            return; // stationary point
+        }
+        for (std::size_t j = 0; j < n; ++j) {
+            d[j] = std::max(d[j], 1e-12 * max_d);
+        }
+        if (mu < 0) {
+            mu = lambda_ * max_d;
+        }
+
+        conjugate_gradients(jacobian, mu, d, g, step, cg_r, cg_p, cg_ap, jp);
+
+        for (std::size_t j = 0; j < n; ++j) {
+            trial[j] = state_.point[j] + step[j];
+        }
+        state_.point.swap(trial);
+        residuals_->evaluate(state_, trial_r.view().data());
+        const double trial_loss = trial_r * trial_r;
+
+        // decrease of |r + J step|^2, the model of the loss
+        double predicted = step * g;
+        for (std::size_t j = 0; j < n; ++j) {
+            predicted += mu * d[j] * step[j] * step[j];
+        }
+        const double rho = predicted > 0 ? (loss - trial_loss) / predicted : -1;
+
+        if (rho > 0 && std::isfinite(trial_loss)) {
+            residuals_->jacobian(state_, r.view().data(), jacobian);
+            loss = trial_loss;
+            mu *= std::max(1.0 / 3, 1 - std::pow(2 * rho - 1, 3));
+            nu = 2;
+        } else {
+            state_.point.swap(trial);
+            mu *= nu;
+            nu *= 2;
+        }
+
+        if (step * step <= 1e-32 * (dot_kernel(state_.point.data(), state_.point.data(), n) + 1e-32)) {
+            return; // no progress left in double precision
+        }
+    }
+}
+
+void LevenbergMarquardt::conjugate_gradients(const SparseMatrix &jacobian, double mu, const Grad<double> &d, const Grad<double> &b,
+                                             Grad<double> &x, Grad<double> &r, Grad<double> &p, Grad<double> &ap, Grad<double> &jp)
+{
+    const std::size_t n = b.size();
+    x *= 0;
+    r = b;
+    p = b;
+    double rr = r * r;
+    const double tolerance = 1e-20 * rr;
+
+    for (std::size_t k = 0; k < 2 * n && rr > tolerance; ++k) {
+        // ap = J^T J p + mu * D p
+        jacobian.multiply(p.view().data(), jp.view().data());
+        jacobian.multiply_transposed(jp.view().data(), ap.view().data());
+        for (std::size_t j = 0; j < n; ++j) {
+            ap[j] += mu * d[j] * p[j];
+        }
+
+        const double alpha = rr / (p * ap);
+        x.axpy(alpha, p);
+        r.axpy(-alpha, ap);
+        const double next = r * r;
+        p.axpby(1, r, next / rr);
+        rr = next;
+    }
+}
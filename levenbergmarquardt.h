@@ -0,0 +1,43 @@
+#ifndef LEVENBERGMARQUARDT_H
+#define LEVENBERGMARQUARDT_H
+
+#include "grad.h"
+#include "parameter.h"
+#include "residuals.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Levenberg-Marquardt on the residuals of a system, the loss is the sum of their squares like for Optimizer.
+// Every step solves (J^T J + mu * D) step = -J^T r by conjugate gradients over the sparse Jacobian,
+// J^T J is never formed. D is the diagonal of J^T J, mu follows the gain ratio of the step.
+// The shared Parameters are only read at construction and written by write_parameters().
+class LevenbergMarquardt
+{
+    std::shared_ptr<const Residuals> residuals_;
+    ResidualState state_;
+    std::vector<std::shared_ptr<Parameter>> parameters{};
+    double loss{100.0};
+    double lambda_;
+    int max_iterations_;
+    double max_loss{1e-20}; // residuals of 1e-10, steps converge to the rounding of the residuals long before 1e-30
+    const std::atomic<bool> *stop_{nullptr};
+
+public:
+    // empty start means the current values of the parameters, mu starts at lambda * max(D)
+    LevenbergMarquardt(std::shared_ptr<const Residuals> residuals, std::vector<double> start = {}, double lambda = 1e-3, int max_iterations = 200);
+    void operator()();
+    double get_loss();
+    bool is_solved();
+    const std::vector<double>& get_solution();
+    void write_parameters();
+    // operator() returns as soon as *stop becomes true
+    void set_stop_flag(const std::atomic<bool> *stop);
+private:
+    // x = (J^T J + mu * D)^-1 b, the rest are work buffers
+    void conjugate_gradients(const SparseMatrix &jacobian, double mu, const Grad<double> &d, const Grad<double> &b,
+                             Grad<double> &x, Grad<double> &r, Grad<double> &p, Grad<double> &ap, Grad<double> &jp);
+};
+
+#endif // LEVENBERGMARQUARDT_H
@@ -1,205 +1,211 @@
 #include "model.h"
-#include "optimizer.h"
+#include "multistart.h"
+#include "levenbergmarquardt.h"
+#include "newtonsolver.h"
 
-#include <thread>
-#include <sstream>
-#include <iostream>
+#include <algorithm>
+#include <string>
 
+namespace {
 
-Model::Model(std::shared_ptr<View> view) : view_(view)
+// the update rule of Optimizer behind method
+OptimizerMethod optimizer_method(SolverMethod method)
 {
-    table.insert({"+", std::make_shared<TwoArgFunction<Plus>>()});
-    table.insert({"-", std::make_shared<TwoArgFunction<Sub>>()});
-    table.insert({"*", std::make_shared<TwoArgFunction<Mul>>()});
-    table.insert({"/", std::make_shared<TwoArgFunction<Dev>>()});
-    table.insert({"cos", std::make_shared<SingleArgFunction<Cos>>()});
-    table.insert({"sin", std::make_shared<SingleArgFunction<Sin>>()});
-    table.insert({"^", std::make_shared<TwoArgFunction<Pow>>()});
+    switch (method) {
+    case SolverMethod::adam:
+        return OptimizerMethod::adam;
+    case SolverMethod::lbfgs:
+        return OptimizerMethod::lbfgs;
+    case SolverMethod::nesterov:
+        return OptimizerMethod::nesterov;
+    case SolverMethod::rmsprop:
+        return OptimizerMethod::rmsprop;
+    case SolverMethod::gradient_descent:
+        return OptimizerMethod::gradient_descent;
+    case SolverMethod::levenberg_marquardt:
+    case SolverMethod::newton:
+        break;
+    }
 
-    range_table.insert({"(", 1});
-    range_table.insert({"sin", 2});
-    range_table.insert({"cos", 2});
-    range_table.insert({"^", 3});
-    range_table.insert({"*", 4});
-    range_table.insert({"/", 4});
-    range_table.insert({"+", 5});
-    range_table.insert({"-", 5});
-    range_table.insert({")", 6});
+    throw std::string{"not an Optimizer method"};
 }
 
+} // namespace
+
+
+Model::Model(std::function<void(std::string)> display) : display_(std::move(display)), pool_(std::make_shared<ThreadPool>()) {}
+
 void Model::add_variables(std::string variables)
 {
-    auto vars = separate(variables);
-    for (auto var : vars) {
-        if (table.find(var) != table.end()) {
-            continue;
-        }
-        auto param = std::make_shared<Parameter>(0, true, var);
-        table.insert({var, std::make_shared<ParameterClassifier>(param)});
-        variables_.push_back(param);
-    }
+    parser_.add_variables(variables);
 }
 
-void Model::decision_process(std::shared_ptr<Differentiable> equations)
+const std::vector<std::shared_ptr<Parameter>>& Model::get_variables()
 {
-    std::cout << "Model::decision_process" << std::endl;
-    Optimizer opti(equations);
-    opti();
-    std::cout << "Model::decision_process after" << std::endl;
-    display_answer(equations->operator()());
+    return parser_.get_variables();
 }
 
-void Model::display_answer(double loss)
+const SystemCache& Model::get_cache()
 {
-    if (loss > 1e-5) {
-        view_->display_decision("no decision");
+    return cache_;
+}
+
+std::shared_ptr<const Tape> Model::compile(std::string_view equations)
+{
+    std::string variables;
+    for (auto &v : parser_.get_variables()) {
+        variables += v->get_name() + " ";
     }
 
-    std::string answer = "";
-    for (auto v : variables_) {
-        answer += std::to_string(v->get_value()) + " ";
+    std::string key = SystemCache::key_of(variables, equations);
+    auto tape = cache_.find(key);
+    if (!tape) {
+        tape = std::make_shared<const Tape>(parser_.make_equation(equations), parser_.get_variables());
+        cache_.insert(key, tape);
     }
 
-    view_->display_decision(answer);
+    return tape;
 }
 
-void Model::solve(std::string equations)
+void Model::set_method(SolverMethod method)
 {
-    if (equations.empty()) {
-        return;
-    }
-
-    std::shared_ptr<Differentiable> equation =  make_equation(equations);
+    method_ = method;
+}
 
-    std::thread t(&Model::decision_process, this, equation);
-    t.detach();
+void Model::set_stop_criteria(const StopCriteria &criteria)
+{
+    criteria_ = criteria;
 }
 
-std::shared_ptr<Differentiable> Model::make_single_equation(std::string equation)
+void Model::cancel()
 {
-    std::vector<std::string> words = separate(equation);
-    std::vector<std::string> rpn = rpn_of(words);
-    std::stack<std::shared_ptr<Differentiable>> s{};
-    for (size_t i = 0; i < rpn.size(); ++i) {
-        if (table.find(rpn[i]) != table.end()) {
-            table[rpn[i]]->operator()(s);
-        } else {
-            size_t eptr = 0;
-            double c = std::stod(rpn[i], &eptr);
-            if (!eptr || eptr != rpn[i].size()) { //строка не пустая || в строке нет мусора
-                throw std::string{"invalid const"};
-            }
-            s.push(std::make_shared<Const>(c));
+    std::lock_guard<std::mutex> lock(mut_);
+    for (auto &flag : stop_flags_) {
+        if (auto stop = flag.lock()) {
+            stop->store(true);
         }
     }
-
-    if (s.size() != 1) {
-        throw std::string{"invalid exp"};
-    }
-
-    return s.top();
+    stop_flags_.clear();
 }
 
-std::shared_ptr<Differentiable> Model::make_equation(std::string equations)
+Profile Model::get_profile()
 {
-    std::vector<std::string> lines{};
-
-    std::istringstream f(equations);
+    std::lock_guard<std::mutex> lock(mut_);
+    return profile_;
+}
 
-    std::string line;
-    while (std::getline(f, line)) {
-        if (line[0] != '#') {
-            lines.push_back(line);
-        }
+std::function<double()> Model::make_process(std::string_view equations)
+{
+    auto cancel = std::make_shared<std::atomic<bool>>(false);
+    {
+        std::lock_guard<std::mutex> lock(mut_);
+        stop_flags_.erase(std::remove_if(stop_flags_.begin(), stop_flags_.end(), [] (auto &flag) { return flag.expired(); }), stop_flags_.end());
+        stop_flags_.push_back(cancel);
     }
 
-    std::shared_ptr<Differentiable> result = make_single_equation(lines[0]);
-    result = result * result;
-    for (std::size_t i = 1; i < lines.size(); ++i) {
-        auto addition = make_single_equation(lines[i]);
-        addition = addition * addition;
-        result = result + addition;
+    // parsing and compiling happen here in the calling thread, solving later in the dispatcher
+    // once the solves queued before are done, so the two parts are measured apart
+    const Profile start = Profiler::snapshot();
+    std::function<double()> process;
+    if (method_ == SolverMethod::levenberg_marquardt) {
+        auto residuals = std::make_shared<const Residuals>(parser_.make_residuals(equations), parser_.get_variables());
+        process = [this, residuals, cancel] { return decision_process(residuals, cancel); };
+    } else {
+        auto tape = compile(equations);
+        process = [this, tape, method = method_, criteria = criteria_, cancel] { return decision_process(tape, method, criteria, cancel); };
     }
 
-    return result;
-}
-
-
-std::vector<std::string> Model::rpn_of(std::vector<std::string> words)
-{
-    std::stack<std::string> for_func{};
-    std::vector<std::string> rpn;
-    while (!words.empty()) {
-        int range = range_of_func(words[0]);
-        if (range == 0) {
-            rpn.push_back(words.front());
-            words.erase(words.begin());
-        } else if (words[0] == ")") {
-            while (!for_func.empty() && for_func.top() != "(") {
-                rpn.push_back(for_func.top());
-                for_func.pop();
-            }
-
-            if (for_func.empty()) {
-                throw std::string{"invalid exp"};
-            } else {
-                for_func.pop();
-                words.erase(words.begin());
-            }
-        } else {
-            while (!for_func.empty() && for_func.top() != "(" && range_of_func(for_func.top()) <= range) {
-                rpn.push_back(for_func.top());
-                for_func.pop();
-            }
-
-            for_func.push(words.front());
-            words.erase(words.begin());
-        }
-    }
+    const Profile prepared = Profiler::snapshot() - start;
 
-    while (!for_func.empty() && for_func.top() != "(") {
-        rpn.push_back(for_func.top());
-        for_func.pop();
-    }
+    return [this, process, prepared] {
+        const Profile start = Profiler::snapshot();
+        double loss = process();
+        const Profile solved = Profiler::snapshot() - start;
 
-    if (!for_func.empty()) {
-        throw std::string{"invalid exp"};
+        std::lock_guard<std::mutex> lock(mut_);
+        profile_ = prepared + solved;
+        return loss;
+    };
+}
+
+double Model::decision_process(std::shared_ptr<const Tape> tape, SolverMethod method, const StopCriteria &criteria, std::shared_ptr<std::atomic<bool>> cancel)
+{
+    Profiler::Timer timer(ProfilePhase::solve);
+    MultiStartSolver multistart(pool_);
+    multistart.set_cancel_flag(std::move(cancel));
+    MultiStartSolver::Result best;
+    if (method == SolverMethod::newton) {
+        best = multistart(tape->make_state().point, [tape] (std::vector<double> start, const std::atomic<bool> *stop) {
+            NewtonSolver solver(tape, std::move(start));
+            solver.set_stop_flag(stop);
+            solver();
+
+            return MultiStartSolver::Result{solver.get_solution(), solver.get_loss(), solver.is_solved()};
+        });
+    } else {
+        best = multistart(tape, criteria, optimizer_method(method));
     }
 
-    return rpn;
+    write_solution(tape->get_parameters(), best.solution);
+    return best.loss;
 }
 
-int Model::range_of_func(std::string func)
+double Model::decision_process(std::shared_ptr<const Residuals> residuals, std::shared_ptr<std::atomic<bool>> cancel)
 {
-    auto res = range_table.find(func);
-    if (res == range_table.end()) {
-        return 0;
+    Profiler::Timer timer(ProfilePhase::solve);
+    MultiStartSolver multistart(pool_);
+    multistart.set_cancel_flag(std::move(cancel));
+    MultiStartSolver::Result best = multistart(residuals->make_state().point,
+        [residuals] (std::vector<double> start, const std::atomic<bool> *stop) {
+            LevenbergMarquardt solver(residuals, std::move(start));
+            solver.set_stop_flag(stop);
+            solver();
+
+            return MultiStartSolver::Result{solver.get_solution(), solver.get_loss(), solver.is_solved()};
+        });
+
+    write_solution(residuals->get_parameters(), best.solution);
+    return best.loss;
+}
+
+void Model::write_solution(const std::vector<std::shared_ptr<Parameter>> &parameters, const std::vector<double> &solution)
+{
+    for (std::size_t i = 0; i < parameters.size(); ++i) {
+        parameters[i]->set_value(solution[i]);
     }
-    return res->second;
 }
 
-std::vector<std::string> Model::separate(const std::string &s)
+std::string Model::make_answer(double loss)
 {
+    if (!(loss <= 1e-5)) { // NaN is no decision either
+        return "no decision";
+    }
 
-    std::vector<std::string> words{};
-    bool is_word = 0;
-    std::string word{};
-    for (auto c : s) {
-        if (c == ' ' && is_word) {
-            words.push_back(word);
-            word = "";
-            is_word = 0;
-        } else if (c != ' ' && is_word) {
-            word += c;
-        } else if (c != ' ' && !is_word) {
-            is_word = 1;
-            word += c;
-        }
+    std::string answer = "";
+    for (auto v : parser_.get_variables()) {
+        answer += std::to_string(v->get_value()) + " ";
     }
 
-    if (!word.empty()) {
-        words.push_back(word);
+    return answer;
+}
+
+void Model::solve(std::string equations)
+{
+    if (equations.empty()) {
+        return;
     }
 
-    return words;
+    auto process = make_process(equations);
+
+    dispatcher_.submit([this, process] {
+        std::string answer = make_answer(process());
+        if (display_) {
+            display_(answer);
+        }
+    });
+}
+
+double Model::solve_now(std::string equations)
+{
+    return dispatcher_.submit(make_process(equations)).get();
 }
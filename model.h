@@ -1,36 +1,77 @@
 #ifndef MODEL_H
 #define MODEL_H
 
-#include "stackprocessor.h"
-#include "view.h"
+#include "parser.h"
+#include "profiler.h"
+#include "stopcriteria.h"
+#include "residuals.h"
+#include "systemcache.h"
+#include "tape.h"
+#include "threadpool.h"
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
-#include <map>
 #include <vector>
 
 
+enum class SolverMethod
+{
+    adam,                // first order on the sum of squares of the equations
+    levenberg_marquardt, // second order on the equations kept apart
+    newton,              // second order on the sum of squares, Hessian-vector products of the tape
+    lbfgs,               // the rest are the other update rules of Optimizer, see OptimizerMethod
+    nesterov,
+    rmsprop,
+    gradient_descent
+};
+
 class Model
 {
 
-    std::map<std::string, std::shared_ptr<StackProcessor>> table{};
-    std::vector<std::shared_ptr<Parameter>> variables_{};
-    std::map<std::string, int> range_table{};
+    Parser parser_{};
+    SystemCache cache_{};
+    SolverMethod method_{SolverMethod::adam};
+    std::function<void(std::string)> display_;
+    StopCriteria criteria_{StopCriteria::with_stall_detection()};
+    Profile profile_{};
+    std::vector<std::weak_ptr<std::atomic<bool>>> stop_flags_{}; // one per solve made and not cancelled yet
+    std::mutex mut_{}; // guards profile_ and stop_flags_
 
-    std::shared_ptr<View> view_;
+    // declared last: pending solves finish before the rest of the model is destroyed
+    std::shared_ptr<ThreadPool> pool_;
+    ThreadPool dispatcher_{1};
 public:
-    Model(std::shared_ptr<View> view);
+    // display receives the answer of every solve(), it is called from a solver thread
+    Model(std::function<void(std::string)> display = {});
 
     void add_variables(std::string variables);
+    // returns at once, the answer goes to display
     void solve(std::string equations);
+    // blocks until solved, writes the solution into the variables and returns the loss
+    double solve_now(std::string equations);
+    const std::vector<std::shared_ptr<Parameter>>& get_variables();
+    const SystemCache& get_cache();
+    // used by the following solves
+    void set_method(SolverMethod method);
+    // of every Optimizer run of the following solves
+    void set_stop_criteria(const StopCriteria &criteria);
+    // stops the solve in progress and the queued ones, safe from any thread. Their answer is "no decision"
+    void cancel();
+    // counters of the last finished solve: its parsing plus its run in the dispatcher, not the waiting
+    // for solves queued before it. Zeros unless built with AUTODIFF_PROFILE
+    Profile get_profile();
 private:
-    void display_answer(double loss);
-    void decision_process(std::shared_ptr<Differentiable> equations);
-    std::vector<std::string> separate(const std::string &s);
-    std::shared_ptr<Differentiable> make_equation(std::string equations);
-    std::shared_ptr<Differentiable> make_single_equation(std::string equation);
-    int range_of_func(std::string func);
-    std::vector<std::string> rpn_of(std::vector<std::string> words);
+    // the tape of the system over the current variables, parsed only on a miss of the cache
+    std::shared_ptr<const Tape> compile(std::string_view equations);
+    // parses in the calling thread, the task solves and returns the loss
+    std::function<double()> make_process(std::string_view equations);
+    std::string make_answer(double loss);
+    double decision_process(std::shared_ptr<const Tape> tape, SolverMethod method, const StopCriteria &criteria, std::shared_ptr<std::atomic<bool>> cancel);
+    double decision_process(std::shared_ptr<const Residuals> residuals, std::shared_ptr<std::atomic<bool>> cancel);
+    void write_solution(const std::vector<std::shared_ptr<Parameter>> &parameters, const std::vector<double> &solution);
 };
 
 #endif // MODEL_H
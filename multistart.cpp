@@ -0,0 +1,76 @@
+#include "multistart.h"
+#include "optimizer.h"
+
+#include <atomic>
+#include <future>
+#include <limits>
+#include <random>
+
+
+MultiStartSolver::MultiStartSolver(std::shared_ptr<ThreadPool> pool, std::size_t starts, double spread)
+    : pool_(pool), starts_(starts ? starts : default_starts), spread_(spread) {}
+
+void MultiStartSolver::set_cancel_flag(std::shared_ptr<std::atomic<bool>> cancel)
+{
+    cancel_ = std::move(cancel);
+}
+
+MultiStartSolver::Result MultiStartSolver::operator()(std::shared_ptr<const Tape> tape, const StopCriteria &criteria, OptimizerMethod method)
+{
+    return operator()(tape->make_state().point, [tape, criteria, method] (std::vector<double> start, const std::atomic<bool> *stop) {
+        Optimizer opti(tape, std::move(start));
+        opti.set_method(method);
+        opti.set_stop_criteria(criteria);
+        opti.set_stop_flag(stop);
+        opti();
+
+        return Result{opti.get_solution(), opti.get_loss(), opti.is_solved()};
+    });
+}
+
+MultiStartSolver::Result MultiStartSolver::operator()(const std::vector<double> &origin, Run solver)
+{
+    auto stop = cancel_ ? cancel_ : std::make_shared<std::atomic<bool>>(false);
+    auto run = [solver, stop] (std::vector<double> start) {
+        Result r = solver(std::move(start), stop.get());
+        if (r.solved) {
+            stop->store(true);
+        }
+
+        return r;
+    };
+
+    std::vector<std::future<Result>> runs;
+    std::vector<Result> done;
+    for (std::size_t k = 0; k < starts_ && !stop->load(); ++k) {
+        std::vector<double> start = origin;
+        if (k > 0) {
+            std::mt19937 gen(k);
+            std::uniform_real_distribution<double> shift(-spread_, spread_);
+            for (auto &x : start) {
+                x += shift(gen);
+            }
+        }
+
+        if (pool_) {
+            runs.push_back(pool_->submit([run, start] { return run(start); }));
+        } else {
+            done.push_back(run(std::move(start)));
+        }
+    }
+
+    for (auto &r : runs) {
+        done.push_back(r.get());
+    }
+
+    // a solved run beats an unsolved one, then the lower loss wins. A diverged run with a NaN loss never wins,
+    // without any finite loss the origin comes back with an infinite one
+    Result best{origin, std::numeric_limits<double>::infinity(), false};
+    for (auto &r : done) {
+        if ((r.solved && !best.solved) || (r.solved == best.solved && r.loss < best.loss)) {
+            best = std::move(r);
+        }
+    }
+
+    return best;
+}
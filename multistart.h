@@ -0,0 +1,52 @@
+#ifndef MULTISTART_H
+#define MULTISTART_H
+
+#include "optimizerstrategy.h"
+#include "stopcriteria.h"
+#include "tape.h"
+#include "threadpool.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Runs independent optimizers from different starting points on a thread pool,
+// all of them stop as soon as one solves the system, the best point wins.
+class MultiStartSolver
+{
+    std::shared_ptr<ThreadPool> pool_;
+    std::size_t starts_;
+    double spread_;
+    std::shared_ptr<std::atomic<bool>> cancel_{};
+public:
+    struct Result
+    {
+        std::vector<double> solution{};
+        double loss{};
+        bool solved{false};
+    };
+
+    // one solver run from start, it must return soon after *stop becomes true
+    using Run = std::function<Result(std::vector<double> start, const std::atomic<bool> *stop)>;
+
+    // fixed so that whether a system gets solved does not depend on the machine
+    static constexpr std::size_t default_starts = 8;
+
+    // 0 starts means default_starts. The pool only decides how the starts run: on its threads at once,
+    // without a pool one after another in the calling thread until one solves the system.
+    // The first start is the current value of the parameters and the rest are uniform in [value - spread, value + spread]
+    MultiStartSolver(std::shared_ptr<ThreadPool> pool, std::size_t starts = default_starts, double spread = 10);
+
+    // Optimizer with method on the tape
+    Result operator()(std::shared_ptr<const Tape> tape, const StopCriteria &criteria = {}, OptimizerMethod method = OptimizerMethod::adam);
+    // any solver, origin is the first start. Solved runs come first, then the lowest loss, NaN losses never win.
+    // Without any finished run with a finite loss the loss is infinite
+    Result operator()(const std::vector<double> &origin, Run solver);
+
+    // storing true in cancel stops the runs and the starts not begun yet, it is also the flag the runs
+    // see as stop, so it becomes true as well when a run solves the system
+    void set_cancel_flag(std::shared_ptr<std::atomic<bool>> cancel);
+};
+
+#endif // MULTISTART_H
@@ -0,0 +1,284 @@
+#include "nativetape.h"
+#include "profiler.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+
+namespace {
+
+constexpr const char *function_name = "autodiff_tape";
+
+// FNV-1a, stable across runs unlike std::hash
+std::uint64_t content_hash(const std::string &s)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : s) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+std::string hex(std::uint64_t x)
+{
+    char buf[17];
+    std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(x));
+    return buf;
+}
+
+// unique per process and call, objects are compiled under it and renamed into place
+std::string temporary_suffix()
+{
+    static std::atomic<unsigned> counter{0};
+#ifdef _WIN32
+    const int pid = _getpid();
+#else
+    const int pid = getpid();
+#endif
+    return "." + std::to_string(pid) + "." + std::to_string(counter++) + ".tmp";
+}
+
+#ifdef _WIN32
+constexpr const char *object_extension = ".dll";
+constexpr const char *compile_flags = " /nologo /O2 /LD ";
+
+std::shared_ptr<void> load(const std::string &path)
+{
+    HMODULE library = LoadLibraryA(path.c_str());
+    if (!library) {
+        return nullptr;
+    }
+
+    return std::shared_ptr<void>(library, [] (void *library) { FreeLibrary(static_cast<HMODULE>(library)); });
+}
+
+void* symbol(void *library, const char *name)
+{
+    return reinterpret_cast<void*>(GetProcAddress(static_cast<HMODULE>(library), name));
+}
+
+// the profile directory of the user is private through its ACL
+void make_private_directory(const std::filesystem::path &directory)
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+}
+#else
+constexpr const char *object_extension = ".so";
+constexpr const char *compile_flags = " -O2 -ffp-contract=off -shared -fPIC -o "; // same rounding as the interpreter
+
+std::shared_ptr<void> load(const std::string &path)
+{
+    void *library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!library) {
+        return nullptr;
+    }
+
+    return std::shared_ptr<void>(library, [] (void *library) { dlclose(library); });
+}
+
+void* symbol(void *library, const char *name)
+{
+    return dlsym(library, name);
+}
+
+// the words of command followed by arguments as they are, without a shell in between,
+// so the paths reach the compiler untouched. Returns the exit status or -1
+int run(const std::string &command, const std::vector<std::string> &arguments)
+{
+    std::vector<std::string> words;
+    std::istringstream stream(command);
+    for (std::string word; stream >> word;) {
+        words.push_back(word);
+    }
+    if (words.empty()) {
+        return -1;
+    }
+    words.insert(words.end(), arguments.begin(), arguments.end());
+
+    std::vector<char*> argv;
+    for (auto &word : words) {
+        argv.push_back(word.data());
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0) {
+        return -1;
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// only the current user may have written what gets loaded into the process
+bool is_private(const std::filesystem::path &path, bool directory)
+{
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0) {
+        return false;
+    }
+
+    return (directory ? S_ISDIR(info.st_mode) : S_ISREG(info.st_mode)) && info.st_uid == geteuid()
+        && (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// the last component is created with mode 0700, an existing one must already be private
+void make_private_directory(const std::filesystem::path &directory)
+{
+    std::error_code error;
+    if (directory.has_parent_path()) {
+        std::filesystem::create_directories(directory.parent_path(), error);
+    }
+    mkdir(directory.c_str(), 0700);
+
+    if (!is_private(directory, true)) {
+        throw std::string{"jit cache directory is not private: " + directory.string()};
+    }
+}
+#endif
+
+} // namespace
+
+
+NativeTape::NativeTape(const Tape &tape, std::string directory, std::string compiler)
+    : parameters_(tape.get_parameters().size())
+{
+    Profiler::Timer timer(ProfilePhase::compile);
+    namespace fs = std::filesystem;
+
+#ifdef _WIN32
+    const std::string source = tape.make_source(std::string{"__declspec(dllexport) "} + function_name);
+#else
+    const std::string source = tape.make_source(function_name);
+#endif
+    const std::string name = hex(content_hash(compiler + compile_flags + '\n' + source));
+    const fs::path object = fs::path(directory) / (name + object_extension);
+
+    make_private_directory(directory);
+
+    std::error_code error;
+#ifdef _WIN32
+    if (fs::exists(object, error)) {
+#else
+    if (fs::exists(object, error) && is_private(object, false)) {
+#endif
+        library_ = load(object.string());
+        cached_ = library_ != nullptr;
+    }
+
+    if (!library_) {
+        const std::string suffix = temporary_suffix();
+        const fs::path source_file = fs::path(directory) / (name + suffix + ".c");
+        const fs::path temporary = fs::path(directory) / (name + suffix + object_extension);
+
+        std::ofstream(source_file) << source;
+#ifdef _WIN32
+        // paths on Windows can not contain double quotes
+        const std::string command = compiler + compile_flags + "\"" + source_file.string() + "\" /Fe\"" + temporary.string() + "\"";
+        const int status = std::system(command.c_str());
+#else
+        const int status = run(compiler + compile_flags, {temporary.string(), source_file.string(), "-lm"});
+#endif
+        fs::remove(source_file, error);
+        if (status != 0) {
+            fs::remove(temporary, error);
+            throw std::string{"jit compilation failed"};
+        }
+
+        // another process may have compiled the same source meanwhile, both objects are equal
+        fs::rename(temporary, object, error);
+        if (error) {
+            fs::remove(temporary, error);
+        }
+        library_ = load(object.string());
+    }
+
+    if (!library_) {
+        throw std::string{"jit object does not load"};
+    }
+    function_ = reinterpret_cast<Function>(symbol(library_.get(), function_name));
+    if (!function_) {
+        throw std::string{"jit object does not load"};
+    }
+}
+
+double NativeTape::operator()(const double *point, double *gradient) const
+{
+    Profiler::add(ProfileCounter::gradient_calls);
+    Profiler::Timer timer(ProfilePhase::gradient);
+    return function_(point, gradient);
+}
+
+double NativeTape::make_grad(const std::vector<double> &point, GradView<double> gradient) const
+{
+    return (*this)(point.data(), gradient.data());
+}
+
+std::size_t NativeTape::size() const
+{
+    return parameters_;
+}
+
+bool NativeTape::from_cache() const
+{
+    return cached_;
+}
+
+std::string NativeTape::default_directory()
+{
+    if (const char *directory = std::getenv("AUTODIFF_JIT_CACHE")) {
+        return directory;
+    }
+
+#ifdef _WIN32
+    const char *cache = std::getenv("LOCALAPPDATA");
+    return (std::filesystem::path(cache ? cache : ".") / "autodiff_jit").string();
+#else
+    if (const char *cache = std::getenv("XDG_CACHE_HOME"); cache && *cache) {
+        return (std::filesystem::path(cache) / "autodiff_jit").string();
+    }
+    const char *home = std::getenv("HOME");
+    return (std::filesystem::path(home && *home ? home : ".") / ".cache" / "autodiff_jit").string();
+#endif
+}
+
+std::string NativeTape::default_compiler()
+{
+    if (const char *compiler = std::getenv("AUTODIFF_JIT_CC")) {
+        return compiler;
+    }
+
+#ifdef _WIN32
+    return "cl";
+#else
+    return "cc";
+#endif
+}
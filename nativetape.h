@@ -0,0 +1,44 @@
+#ifndef NATIVETAPE_H
+#define NATIVETAPE_H
+
+#include "grad.h"
+#include "tape.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Tape::make_source compiled by the system C compiler into a shared object and loaded at runtime.
+// Objects are kept in directory under the hash of their source and the compiler command line,
+// so the same system is compiled once across restarts. Evaluation only reads the point, any
+// number of threads can call one NativeTape.
+class NativeTape
+{
+    using Function = double (*)(const double *point, double *gradient);
+
+    std::shared_ptr<void> library_{};
+    Function function_{nullptr};
+    std::size_t parameters_;
+    bool cached_{false};
+public:
+    // throws when the compiler fails or the object does not load. On POSIX systems directory is
+    // created with mode 0700, one that is not owned by the user or is writable by others is refused
+    NativeTape(const Tape &tape, std::string directory = default_directory(), std::string compiler = default_compiler());
+
+    // value at point, gradient has get_parameters().size() elements of the tape
+    double operator()(const double *point, double *gradient) const;
+    double make_grad(const std::vector<double> &point, GradView<double> gradient) const;
+
+    std::size_t size() const;
+    // true when the object came from the directory without compiling
+    bool from_cache() const;
+
+    // $AUTODIFF_JIT_CACHE or autodiff_jit in the cache directory of the user:
+    // $XDG_CACHE_HOME, ~/.cache or %LOCALAPPDATA%
+    static std::string default_directory();
+    // $AUTODIFF_JIT_CC or cc, split into words on spaces and run without a shell, the object and the source are appended
+    static std::string default_compiler();
+};
+
+#endif // NATIVETAPE_H
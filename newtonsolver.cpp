@@ -0,0 +1,163 @@
+#include "newtonsolver.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+
+NewtonSolver::NewtonSolver(std::shared_ptr<const Tape> tape, std::vector<double> start, double radius, int max_iterations)
+    : tape_(std::move(tape)), state_(tape_->make_state()), radius_(radius), max_iterations_(max_iterations)
+{
+    parameters = tape_->get_parameters();
+    if (!start.empty()) {
+        if (start.size() != parameters.size()) {
+            throw std::string{"invalid start point"};
+        }
+        state_.point = std::move(start);
+    }
+}
+
+double NewtonSolver::get_loss()
+{
+    return loss;
+}
+
+bool NewtonSolver::is_solved()
+{
+    return loss <= max_loss;
+}
+
+const std::vector<double>& NewtonSolver::get_solution()
+{
+    return state_.point;
+}
+
+void NewtonSolver::write_parameters()
+{
+    for (std::size_t i = 0; i < parameters.size(); ++i) {
+        parameters[i]->set_value(state_.point[i]);
+    }
+}
+
+void NewtonSolver::set_stop_flag(const std::atomic<bool> *stop)
+{
+    stop_ = stop;
+}
+
+void NewtonSolver::operator()()
+{
+    const std::size_t n = parameters.size();
+
+    // all buffers are allocated once, the loop itself works in place
+    Grad<double> g(std::vector<double>(n, 0));
+    Grad<double> step(std::vector<double>(n, 0));
+    Grad<double> hs(std::vector<double>(n, 0));
+    std::vector<double> trial(n, 0);
+    Grad<double> cg_r(std::vector<double>(n, 0));
+    Grad<double> cg_d(std::vector<double>(n, 0));
+    Grad<double> cg_hd(std::vector<double>(n, 0));
+    Grad<double> cg_g(std::vector<double>(n, 0));
+
+    tape_->make_grad(state_, g);
+    loss = state_.get_value();
+
+    double radius = radius_;
+    for (int t = 0; ; ++t) {
+        if (loss <= max_loss || t >= max_iterations_ || (stop_ && stop_->load(std::memory_order_relaxed))) {
+            return;
+        }
+        Profiler::add(ProfileCounter::iterations);
+        if (g * g == 0) {
+            return; // stationary point
+        }
+
+        steihaug(g, radius, step, hs, cg_r, cg_d, cg_hd, cg_g);
+
+        for (std::size_t j = 0; j < n; ++j) {
+            trial[j] = state_.point[j] + step[j];
+        }
+        state_.point.swap(trial);
+        const double trial_loss = (*tape_)(state_);
+
+        // decrease of the quadratic model
+        const double predicted = -(g * step + 0.5 * (step * hs));
+        const double rho = predicted > 0 ? (loss - trial_loss) / predicted : -1;
+        const double length = std::sqrt(step * step);
+
+        if (rho > 1e-4 && std::isfinite(trial_loss)) {
+            tape_->make_grad(state_, g);
+            loss = trial_loss;
+        } else {
+            state_.point.swap(trial);
+        }
+
+        if (rho < 0.25) {
+            radius = 0.25 * length;
+        } else if (rho > 0.75 && length >= 0.99 * radius) {
+            radius *= 2;
+        }
+
+        if (radius * radius <= 1e-32 * (dot_kernel(state_.point.data(), state_.point.data(), n) + 1e-32)) {
+            return; // no progress left in double precision
+        }
+    }
+}
+
+void NewtonSolver::steihaug(const Grad<double> &g, double radius, Grad<double> &step, Grad<double> &hs,
+                            Grad<double> &r, Grad<double> &d, Grad<double> &hd, Grad<double> &gradient)
+{
+    const std::size_t n = g.size();
+    step *= 0;
+    hs *= 0;
+    r = g;
+    d = g;
+    d *= -1;
+    double rr = r * r;
+    // inexact Newton, the forcing term min(1/2, sqrt|g|) gives superlinear convergence
+    const double tolerance = rr * std::min(0.25, std::sqrt(rr));
+
+    // tau >= 0 with |step + tau * d| = radius
+    auto to_border = [&] {
+        const double dd = d * d;
+        const double sd = step * d;
+        const double ss = step * step;
+        return (-sd + std::sqrt(std::max(0.0, sd * sd + dd * (radius * radius - ss)))) / dd;
+    };
+
+    for (std::size_t k = 0; k < 2 * n; ++k) {
+        hessian_times(d, hd, gradient);
+        const double curvature = d * hd;
+        if (curvature <= 0) {
+            const double tau = to_border();
+            step.axpy(tau, d);
+            hs.axpy(tau, hd);
+            return;
+        }
+
+        const double alpha = rr / curvature;
+        const double ss = step * step;
+        const double sd = step * d;
+        if (ss + 2 * alpha * sd + alpha * alpha * (d * d) >= radius * radius) {
+            const double tau = to_border();
+            step.axpy(tau, d);
+            hs.axpy(tau, hd);
+            return;
+        }
+
+        step.axpy(alpha, d);
+        hs.axpy(alpha, hd);
+        r.axpy(alpha, hd);
+        const double next = r * r;
+        if (next <= tolerance) {
+            return;
+        }
+        d.axpby(-1, r, next / rr);
+        rr = next;
+    }
+}
+
+void NewtonSolver::hessian_times(const Grad<double> &v, Grad<double> &hv, Grad<double> &gradient)
+{
+    tape_->hessian_vector(state_, v.view().data(), gradient, hv);
+}
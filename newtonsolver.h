@@ -0,0 +1,45 @@
+#ifndef NEWTONSOLVER_H
+#define NEWTONSOLVER_H
+
+#include "grad.h"
+#include "parameter.h"
+#include "tape.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Trust region Newton on the loss of a tape. Every step minimizes the quadratic model
+// g^T s + s^T H s / 2 inside the region by Steihaug conjugate gradients, H only enters through
+// Tape::hessian_vector, so negative curvature just sends the step to the border of the region.
+// The shared Parameters are only read at construction and written by write_parameters().
+class NewtonSolver
+{
+    std::shared_ptr<const Tape> tape_;
+    TapeState state_;
+    std::vector<std::shared_ptr<Parameter>> parameters{};
+    double loss{100.0};
+    double radius_;
+    int max_iterations_;
+    double max_loss{1e-20}; // same as LevenbergMarquardt, quadratic steps stop at the rounding of the residuals
+    const std::atomic<bool> *stop_{nullptr};
+
+public:
+    // empty start means the current values of the parameters
+    NewtonSolver(std::shared_ptr<const Tape> tape, std::vector<double> start = {}, double radius = 1, int max_iterations = 200);
+    void operator()();
+    double get_loss();
+    bool is_solved();
+    const std::vector<double>& get_solution();
+    void write_parameters();
+    // operator() returns as soon as *stop becomes true
+    void set_stop_flag(const std::atomic<bool> *stop);
+private:
+    // approximate minimum of the model inside the region into step, hs = H step, the rest are work buffers
+    void steihaug(const Grad<double> &g, double radius, Grad<double> &step, Grad<double> &hs,
+                  Grad<double> &r, Grad<double> &d, Grad<double> &hd, Grad<double> &gradient);
+    // Hessian of the loss at the current point times v, gradient is overwritten
+    void hessian_times(const Grad<double> &v, Grad<double> &hv, Grad<double> &gradient);
+};
+
+#endif // NEWTONSOLVER_H
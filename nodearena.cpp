@@ -0,0 +1,32 @@
+#include "nodearena.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdint>
+
+
+void* NodeArena::allocate(std::size_t size, std::size_t alignment)
+{
+    std::size_t padding = (alignment - reinterpret_cast<std::uintptr_t>(current_) % alignment) % alignment;
+    if (current_ == nullptr || padding + size > left_) {
+        std::size_t new_block = std::max(block_size, size + alignment);
+        blocks_.push_back(std::make_unique<std::byte[]>(new_block));
+        Profiler::add(ProfileCounter::arena_blocks);
+        current_ = blocks_.back().get();
+        left_ = new_block;
+        padding = (alignment - reinterpret_cast<std::uintptr_t>(current_) % alignment) % alignment;
+    }
+
+    void *result = current_ + padding;
+    current_ += padding + size;
+    left_ -= padding + size;
+    allocated_ += size;
+    Profiler::add(ProfileCounter::arena_bytes, size);
+
+    return result;
+}
+
+std::size_t NodeArena::allocated()
+{
+    return allocated_;
+}
@@ -0,0 +1,63 @@
+#ifndef NODEARENA_H
+#define NODEARENA_H
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+
+
+// Bump allocator for expression nodes. Memory is never returned one node at a time,
+// all blocks are freed together when the arena is destroyed.
+class NodeArena
+{
+    static constexpr std::size_t block_size = 64 * 1024;
+
+    std::vector<std::unique_ptr<std::byte[]>> blocks_{};
+    std::byte *current_{nullptr};
+    std::size_t left_{0};
+    std::size_t allocated_{0};
+public:
+    NodeArena() = default;
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    void* allocate(std::size_t size, std::size_t alignment);
+    std::size_t allocated();
+};
+
+// Allocator for std::allocate_shared, every copy keeps the arena alive
+template<typename T>
+class ArenaAllocator
+{
+    template<typename U> friend class ArenaAllocator;
+
+    std::shared_ptr<NodeArena> arena_;
+public:
+    using value_type = T;
+
+    ArenaAllocator(std::shared_ptr<NodeArena> arena) : arena_(std::move(arena)) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena_) {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t) {/*Empty*/}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U> &other) const
+    {
+        return arena_ == other.arena_;
+    }
+
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const
+    {
+        return arena_ != other.arena_;
+    }
+};
+
+#endif // NODEARENA_H
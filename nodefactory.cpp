@@ -0,0 +1,106 @@
+#include "nodefactory.h"
+
+#include <cstring>
+#include <functional>
+
+
+NodeFactory::NodeFactory() : arena_(std::make_shared<NodeArena>()) {}
+
+std::size_t NodeFactory::KeyHash::operator()(const Key &key) const
+{
+    std::size_t h = key.type.hash_code();
+    h = h * 31 + std::hash<const void*>()(key.x);
+    h = h * 31 + std::hash<const void*>()(key.y);
+    h = h * 31 + std::hash<std::uint64_t>()(key.c);
+    return h;
+}
+
+std::shared_ptr<Differentiable> NodeFactory::constant(double c)
+{
+    Key key{typeid(Const), nullptr, nullptr, 0};
+    std::memcpy(&key.c, &c, sizeof(c));
+
+    auto it = nodes_.find(key);
+    if (it != nodes_.end()) {
+        return it->second;
+    }
+
+    return insert<Const>(key, c);
+}
+
+std::shared_ptr<Differentiable> NodeFactory::variable(std::shared_ptr<Parameter> parameter)
+{
+    Key key{typeid(Var), parameter.get(), nullptr, 0};
+
+    auto it = nodes_.find(key);
+    if (it != nodes_.end()) {
+        return it->second;
+    }
+
+    return insert<Var>(key, std::move(parameter));
+}
+
+std::shared_ptr<Differentiable> NodeFactory::rebuild(const std::shared_ptr<Differentiable> &node)
+{
+    auto it = rebuilt_.find(node.get());
+    if (it != rebuilt_.end()) {
+        return it->second;
+    }
+
+    ++rebuilding_;
+    std::shared_ptr<Differentiable> copy = node->rebuild(*this);
+    --rebuilding_;
+
+    // the caller may free the expression afterwards, so its addresses are not kept
+    if (rebuilding_ == 0) {
+        rebuilt_.clear();
+    } else {
+        rebuilt_[node.get()] = copy;
+    }
+
+    return copy;
+}
+
+bool NodeFactory::is_constant(const std::shared_ptr<Differentiable> &x, double &c)
+{
+    if (!dynamic_cast<Const*>(x.get())) {
+        return false;
+    }
+
+    c = x->get_value();
+    return true;
+}
+
+std::shared_ptr<Differentiable> NodeFactory::power(std::shared_ptr<Differentiable> x, int n)
+{
+    if (n == 0) {
+        return constant(1);
+    }
+    if (n < 0) {
+        return make<Dev>(constant(1), power(std::move(x), -n));
+    }
+
+    // square and multiply, the squares are shared
+    std::shared_ptr<Differentiable> result{};
+    while (n) {
+        if (n & 1) {
+            result = result ? make<Mul>(result, x) : x;
+        }
+        n >>= 1;
+        if (n) {
+            x = make<Mul>(x, x);
+        }
+    }
+
+    return result;
+}
+
+std::size_t NodeFactory::size()
+{
+    return nodes_.size();
+}
+
+std::size_t NodeFactory::allocated()
+{
+    return arena_->allocated();
+}
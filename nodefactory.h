@@ -0,0 +1,158 @@
+#ifndef NODEFACTORY_H
+#define NODEFACTORY_H
+
+#include "differentiable.h"
+#include "parameter.h"
+#include "nodearena.h"
+
+#include <memory>
+#include <typeindex>
+#include <type_traits>
+#include <unordered_map>
+#include <cstdint>
+#include <cmath>
+
+
+// Hash-consing constructor of nodes: structurally identical subtrees are built once
+// and shared, so the result is a DAG. Arguments must be made by the same factory.
+// Nodes are placed in the factory's arena, which is freed once the factory and all of its nodes are gone.
+// Every node is simplified on construction: constant arguments are folded, identities such as
+// x + 0, x * 1 and x ^ 1 return x, and small integer powers become multiplications.
+class NodeFactory
+{
+    struct Key
+    {
+        std::type_index type;
+        const void *x;
+        const void *y;
+        std::uint64_t c;
+
+        bool operator==(const Key &other) const
+        {
+            return type == other.type && x == other.x && y == other.y && c == other.c;
+        }
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const Key &key) const;
+    };
+
+    static constexpr int max_power = 16;
+
+    std::shared_ptr<NodeArena> arena_;
+    std::unordered_map<Key, std::shared_ptr<Differentiable>, KeyHash> nodes_{};
+    std::unordered_map<Differentiable*, std::shared_ptr<Differentiable>> rebuilt_{}; // during one rebuild() only
+    std::size_t rebuilding_{0};
+
+    template<typename D, typename... Args>
+    std::shared_ptr<Differentiable> insert(const Key &key, Args&&... args)
+    {
+        std::shared_ptr<Differentiable> node = std::allocate_shared<D>(ArenaAllocator<D>(arena_), std::forward<Args>(args)...);
+        nodes_.emplace(key, node);
+        return node;
+    }
+
+    static bool is_constant(const std::shared_ptr<Differentiable> &x, double &c);
+    std::shared_ptr<Differentiable> power(std::shared_ptr<Differentiable> x, int n);
+
+    // nullptr when no rule applies
+    template<typename D>
+    std::shared_ptr<Differentiable> simplify(const std::shared_ptr<Differentiable> &x, const std::shared_ptr<Differentiable> &y)
+    {
+        double a = 0;
+        double b = 0;
+        const bool const_x = is_constant(x, a);
+        const bool const_y = is_constant(y, b);
+        if (const_x && const_y) {
+            return constant(D(x, y)());
+        }
+
+        if constexpr (std::is_same_v<D, Plus>) {
+            if (const_x && a == 0) {
+                return y;
+            }
+            if (const_y && b == 0) {
+                return x;
+            }
+        } else if constexpr (std::is_same_v<D, Sub>) {
+            if (const_y && b == 0) {
+                return x;
+            }
+            if (const_x && a == 0) {
+                return make<Neg>(y);
+            }
+        } else if constexpr (std::is_same_v<D, Mul>) {
+            if (const_x && a == 1) {
+                return y;
+            }
+            if (const_y && b == 1) {
+                return x;
+            }
+        } else if constexpr (std::is_same_v<D, Dev>) {
+            if (const_y && b == 1) {
+                return x;
+            }
+        } else if constexpr (std::is_same_v<D, Pow>) {
+            if (const_y && std::abs(b) <= max_power && b == std::trunc(b)) {
+                return power(x, static_cast<int>(b));
+            }
+        }
+
+        return nullptr;
+    }
+public:
+    NodeFactory();
+    NodeFactory(const NodeFactory&) = delete;
+    NodeFactory& operator=(const NodeFactory&) = delete;
+
+    std::shared_ptr<Differentiable> constant(double c);
+    std::shared_ptr<Differentiable> variable(std::shared_ptr<Parameter> parameter);
+
+    template<typename D>
+    std::shared_ptr<Differentiable> make(std::shared_ptr<Differentiable> x)
+    {
+        double a = 0;
+        if (is_constant(x, a)) {
+            return constant(D(x)());
+        }
+
+        Key key{typeid(D), x.get(), nullptr, 0};
+        auto it = nodes_.find(key);
+        if (it != nodes_.end()) {
+            return it->second;
+        }
+
+        return insert<D>(key, std::move(x));
+    }
+
+    template<typename D>
+    std::shared_ptr<Differentiable> make(std::shared_ptr<Differentiable> x, std::shared_ptr<Differentiable> y)
+    {
+        if constexpr (std::is_same_v<D, Plus> || std::is_same_v<D, Mul>) {
+            if (std::less<Differentiable*>()(y.get(), x.get())) {
+                std::swap(x, y);
+            }
+        }
+
+        if (auto simple = simplify<D>(x, y)) {
+            return simple;
+        }
+
+        Key key{typeid(D), x.get(), y.get(), 0};
+        auto it = nodes_.find(key);
+        if (it != nodes_.end()) {
+            return it->second;
+        }
+
+        return insert<D>(key, std::move(x), std::move(y));
+    }
+
+    // copy of an expression made elsewhere, simplified and with shared subexpressions merged
+    std::shared_ptr<Differentiable> rebuild(const std::shared_ptr<Differentiable> &node);
+
+    std::size_t size();
+    std::size_t allocated();
+};
+
+#endif // NODEFACTORY_H
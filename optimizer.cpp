@@ -1,22 +1,134 @@
 #include "optimizer.h"
+#include "nodefactory.h"
+#include "profiler.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
-#include <iostream>
+#include <limits>
+#include <string>
 
-Optimizer::Optimizer(std::shared_ptr<Differentiable> cond_to_min, double lr, double beta_1, double beta_2)
-    : cond_to_min_(cond_to_min), lr_(lr), beta_1_(beta_1), beta_2_(beta_2)
+namespace {
+
+// simplified before compiling, the gradient keeps the parameters of the original expression
+std::shared_ptr<const Tape> make_tape(const std::shared_ptr<Differentiable> &cond_to_min)
+{
+    std::vector<std::shared_ptr<Parameter>> parameters;
+    cond_to_min->get_all_parameters(parameters);
+
+    return std::make_shared<const Tape>(NodeFactory().rebuild(cond_to_min), parameters);
+}
+
+} // namespace
+
+Optimizer::Optimizer(std::shared_ptr<Differentiable> cond_to_min, double lr, double beta_1, double beta_2, DiffMode mode)
+    : Optimizer(make_tape(cond_to_min), {}, lr, beta_1, beta_2, mode) {}
+
+Optimizer::Optimizer(std::shared_ptr<const Tape> tape, std::vector<double> start, double lr, double beta_1, double beta_2, DiffMode mode)
+    : tape_(std::move(tape)), state_(tape_->make_state()), lr_(lr), beta_1_(beta_1), beta_2_(beta_2), mode_(mode)
 {
-    cond_to_min_->get_all_parameters(parameters);
+    parameters = tape_->get_parameters();
+    if (!start.empty()) {
+        if (start.size() != parameters.size()) {
+            throw std::string{"invalid start point"};
+        }
+        state_.point = std::move(start);
+    }
+    point_ = state_.point;
 }
 
 Optimizer::~Optimizer() = default;
 
+double Optimizer::get_loss()
+{
+    return loss;
+}
+
+bool Optimizer::is_solved()
+{
+    return loss <= criteria_.loss;
+}
+
+const std::vector<double>& Optimizer::get_solution()
+{
+    return point_;
+}
+
+void Optimizer::write_parameters()
+{
+    for (std::size_t i = 0; i < parameters.size(); ++i) {
+        parameters[i]->set_value(point_[i]);
+    }
+}
+
+void Optimizer::set_stop_flag(const std::atomic<bool> *stop)
+{
+    stop_ = stop;
+}
+
+void Optimizer::set_stop_criteria(const StopCriteria &criteria)
+{
+    criteria_ = criteria;
+}
+
+StopReason Optimizer::get_stop_reason()
+{
+    return reason_;
+}
+
+void Optimizer::set_native(std::shared_ptr<const NativeTape> native)
+{
+    if (native && native->size() != parameters.size()) {
+        throw std::string{"invalid native tape"};
+    }
+    native_ = std::move(native);
+}
+
+void Optimizer::set_method(OptimizerMethod method)
+{
+    method_ = method;
+    strategy_.reset();
+}
+
+void Optimizer::set_strategy(std::unique_ptr<OptimizerStrategy> strategy)
+{
+    strategy_ = std::move(strategy);
+}
+
+double Optimizer::evaluate(const std::vector<double> &point, GradView<double> gradient)
+{
+    if (native_) {
+        return native_->make_grad(point, gradient);
+    }
+
+    state_.point.assign(point.begin(), point.end());
+    tape_->make_grad(state_, gradient, mode_);
+    return state_.get_value();
+}
 
-void Optimizer::step_for_parameters(Grad<double> grad)
+StopReason Optimizer::stop_reason(int t, double gradient_norm2, double best, double window_best, std::chrono::steady_clock::time_point start) const
 {
-    for (int i = 0; i < parameters.size(); ++i) {
-        parameters[i]->set_value(parameters[i]->get_value() + grad[i]);
+    if (loss <= criteria_.loss) {
+        return StopReason::solved;
+    }
+    if (stop_ && stop_->load(std::memory_order_relaxed)) {
+        return StopReason::cancelled;
+    }
+    if (t >= criteria_.max_iterations) {
+        return StopReason::iterations;
+    }
+    if (gradient_norm2 <= criteria_.gradient * criteria_.gradient) {
+        return StopReason::gradient;
+    }
+    if (criteria_.window > 0 && t > 0 && t % criteria_.window == 0 && window_best - best <= criteria_.relative * window_best) {
+        return StopReason::stalled;
     }
+    // the clock is read once per 64 iterations
+    if (criteria_.deadline.count() > 0 && t % 64 == 0 && std::chrono::steady_clock::now() - start >= criteria_.deadline) {
+        return StopReason::deadline;
+    }
+
+    return StopReason::running;
 }
 
 bool isEqual(double a, double b)
@@ -27,34 +139,34 @@ bool isEqual(double a, double b)
 
 void Optimizer::operator()()
 {
-    std::vector<double> tmp(parameters.size());
-    for (auto x : tmp) {
-        x = 0;
-    }
-    Grad<double> moment = Grad(tmp);
-    double v = 0;
-    double t_beta_1 = beta_1_;
-    double t_beta_2 = beta_2_;
+    // all buffers are allocated once, the loop itself works in place
+    Grad<double> g(std::vector<double>(parameters.size(), 0));
+    std::unique_ptr<OptimizerStrategy> fresh = strategy_ ? nullptr : make_strategy(method_, parameters.size(), lr_, beta_1_, beta_2_);
+    OptimizerStrategy &strategy = strategy_ ? *strategy_ : *fresh;
 
     int t = 0;
-    constexpr int num_of_iterations = 50000;
+    const auto start = std::chrono::steady_clock::now();
+    loss = evaluate(point_, g);
+    double best = loss;
+    double window_best = std::numeric_limits<double>::infinity(); // the best loss window iterations ago
 
     while(1) {
-        Grad<double> g = cond_to_min_->make_grad();
-        loss = cond_to_min_->get_value();
-        if (loss <= max_loss || t >= num_of_iterations) {
+        reason_ = stop_reason(t, g * g, best, window_best, start);
+        if (reason_ != StopReason::running) {
             return;
         }
+        if (criteria_.window > 0 && t % criteria_.window == 0) {
+            window_best = best;
+        }
 
-        moment = moment * beta_1_ + g * (1 - beta_1_);
-        v = beta_2_ * v + (1 - beta_2_) * (g * g);
-        auto moment_hat = moment / (1 - t_beta_1);
-        t_beta_1 *= beta_1_;
-        auto v_hat = v / (1 - t_beta_2);
-        t_beta_2 *= t_beta_2;
-
-        step_for_parameters(moment_hat * (-lr_) / (std::sqrt(v_hat) + eps));
+        // a rule that finds no lower loss has nowhere left to go
+        if (!strategy.step(*this, point_, loss, g)) {
+            reason_ = StopReason::stalled;
+            return;
+        }
+        best = std::min(best, loss);
         ++t;
+        Profiler::add(ProfileCounter::iterations);
     }
 }
 
@@ -3,28 +3,61 @@
 
 #include "differentiable.h"
 #include "parameter.h"
+#include "nativetape.h"
+#include "optimizerstrategy.h"
+#include "stopcriteria.h"
+#include "tape.h"
 
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <vector>
 
-class Optimizer
+// First order minimization of a tape over its own TapeState, Adam unless set_method or set_strategy
+// picks another update rule. The shared Parameters are only read at construction and written by
+// write_parameters(), so several optimizers can run on one tape at once.
+class Optimizer : private Objective
 {
-    std::shared_ptr<Differentiable> cond_to_min_;
+    std::shared_ptr<const Tape> tape_;
+    TapeState state_;
+    std::vector<double> point_;
     std::vector<std::shared_ptr<Parameter>> parameters{};
     double loss{100.0};
     double lr_;
     double beta_1_;
     double beta_2_;
-    double eps{1e-8};
-    double max_loss{1e-30};
+    OptimizerMethod method_{OptimizerMethod::adam};
+    std::unique_ptr<OptimizerStrategy> strategy_{};
+    StopCriteria criteria_{};
+    StopReason reason_{StopReason::running};
+    DiffMode mode_;
+    const std::atomic<bool> *stop_{nullptr};
+    std::shared_ptr<const NativeTape> native_{};
 
 public:
-    Optimizer(std::shared_ptr<Differentiable> cond_to_min, double lr = 1e-3, double beta_1 = 0.9, double beta_2 = 0.999);
+    Optimizer(std::shared_ptr<Differentiable> cond_to_min, double lr = 1e-3, double beta_1 = 0.9, double beta_2 = 0.999, DiffMode mode = DiffMode::reverse);
+    // empty start means the current values of the parameters
+    Optimizer(std::shared_ptr<const Tape> tape, std::vector<double> start, double lr = 1e-3, double beta_1 = 0.9, double beta_2 = 0.999, DiffMode mode = DiffMode::reverse);
     ~Optimizer();
     void operator()();
     double get_loss();
+    bool is_solved();
+    const std::vector<double>& get_solution();
+    void write_parameters();
+    // operator() returns as soon as *stop becomes true
+    void set_stop_flag(const std::atomic<bool> *stop);
+    void set_stop_criteria(const StopCriteria &criteria);
+    // why the last operator() returned
+    StopReason get_stop_reason();
+    // value and gradient from native code compiled from the same tape instead of Tape::make_grad
+    void set_native(std::shared_ptr<const NativeTape> native);
+    // every operator() starts the rule of method afresh from the rates of the constructor
+    void set_method(OptimizerMethod method);
+    // any other rule, kept with its state across calls of operator() until the next set_method
+    void set_strategy(std::unique_ptr<OptimizerStrategy> strategy);
 private:
-    void step_for_parameters(Grad<double> grad);
+    double evaluate(const std::vector<double> &point, GradView<double> gradient) override;
+    StopReason stop_reason(int t, double gradient_norm2, double best, double window_best, std::chrono::steady_clock::time_point start) const;
 };
 
 #endif // OPTIMIZER_H
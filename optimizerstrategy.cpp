@@ -0,0 +1,259 @@
+#include "optimizerstrategy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+
+
+std::unique_ptr<OptimizerStrategy> make_strategy(OptimizerMethod method, std::size_t size, double lr, double beta_1, double beta_2)
+{
+    switch (method) {
+    case OptimizerMethod::adam:
+        return std::make_unique<AdamStrategy>(size, lr, beta_1, beta_2);
+    case OptimizerMethod::lbfgs:
+        return std::make_unique<LbfgsStrategy>(size);
+    case OptimizerMethod::nesterov:
+        return std::make_unique<NesterovStrategy>(size, lr, beta_1);
+    case OptimizerMethod::rmsprop:
+        return std::make_unique<RmspropStrategy>(size, lr, beta_2);
+    case OptimizerMethod::gradient_descent:
+        return std::make_unique<GradientDescentStrategy>(size);
+    }
+
+    throw std::string{"invalid optimizer method"};
+}
+
+
+//Adam
+
+AdamStrategy::AdamStrategy(std::size_t size, double lr, double beta_1, double beta_2)
+    : moment_(std::vector<double>(size, 0)), v_(std::vector<double>(size, 0)), step_(std::vector<double>(size, 0)),
+      lr_(lr), beta_1_(beta_1), beta_2_(beta_2), t_beta_1_(beta_1), t_beta_2_(beta_2) {}
+
+bool AdamStrategy::step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient)
+{
+    adam_kernel(step_.view().data(), moment_.view().data(), v_.view().data(), gradient.view().data(), point.size(),
+                beta_1_, beta_2_, lr_ / (1 - t_beta_1_), 1 / (1 - t_beta_2_), eps);
+    t_beta_1_ *= beta_1_;
+    t_beta_2_ *= beta_2_;
+
+    GradView<double>(point.data(), point.size()) += step_;
+    loss = objective.evaluate(point, gradient);
+    return true;
+}
+
+
+//Nesterov
+
+NesterovStrategy::NesterovStrategy(std::size_t size, double lr, double momentum)
+    : velocity_(std::vector<double>(size, 0)), lr_(lr), momentum_(momentum) {}
+
+// the look-ahead written in the current point: v' = m v - lr g, x += (1 + m) v' - m v
+bool NesterovStrategy::step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient)
+{
+    for (std::size_t i = 0; i < point.size(); ++i) {
+        double previous = velocity_[i];
+        velocity_[i] = momentum_ * previous - lr_ * gradient[i];
+        point[i] += (1 + momentum_) * velocity_[i] - momentum_ * previous;
+    }
+
+    loss = objective.evaluate(point, gradient);
+    return true;
+}
+
+
+//RMSProp
+
+RmspropStrategy::RmspropStrategy(std::size_t size, double lr, double decay)
+    : square_(std::vector<double>(size, 0)), lr_(lr), decay_(decay) {}
+
+bool RmspropStrategy::step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient)
+{
+    for (std::size_t i = 0; i < point.size(); ++i) {
+        square_[i] = decay_ * square_[i] + (1 - decay_) * gradient[i] * gradient[i];
+        point[i] -= lr_ * gradient[i] / (std::sqrt(square_[i]) + eps);
+    }
+
+    loss = objective.evaluate(point, gradient);
+    return true;
+}
+
+
+//Gradient descent
+
+GradientDescentStrategy::GradientDescentStrategy(std::size_t size)
+    : trial_(size, 0), trial_gradient_(std::vector<double>(size, 0)) {}
+
+// halves the step until the loss falls by c1 of the linear prediction, the next step starts twice as long
+bool GradientDescentStrategy::step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient)
+{
+    const double norm2 = gradient * gradient;
+    if (norm2 == 0) {
+        return false;
+    }
+
+    for (double alpha = alpha_; alpha > 1e-300; alpha /= 2) {
+        for (std::size_t i = 0; i < point.size(); ++i) {
+            trial_[i] = point[i] - alpha * gradient[i];
+        }
+
+        double trial_loss = objective.evaluate(trial_, trial_gradient_);
+        if (std::isfinite(trial_loss) && trial_loss <= loss - c1_ * alpha * norm2) {
+            point.swap(trial_);
+            std::swap(gradient, trial_gradient_);
+            loss = trial_loss;
+            alpha_ = 2 * alpha;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+//L-BFGS
+
+LbfgsStrategy::LbfgsStrategy(std::size_t size, std::size_t memory)
+    : memory_(memory), s_(memory, Grad<double>(std::vector<double>(size, 0))), y_(memory, Grad<double>(std::vector<double>(size, 0))),
+      rho_(memory, 0), alpha_(memory, 0), direction_(std::vector<double>(size, 0)), trial_(size, 0),
+      trial_gradient_(std::vector<double>(size, 0)) {}
+
+void LbfgsStrategy::two_loop(const Grad<double> &gradient)
+{
+    direction_ = gradient;
+    for (std::size_t k = 0; k < stored_; ++k) {
+        std::size_t i = (next_ + memory_ - 1 - k) % memory_;
+        alpha_[i] = rho_[i] * (s_[i].view() * direction_);
+        direction_.view().axpy(-alpha_[i], y_[i]);
+    }
+
+    // initial inverse Hessian s^T y / y^T y of the newest pair
+    if (stored_ > 0) {
+        std::size_t newest = (next_ + memory_ - 1) % memory_;
+        direction_.view() *= 1 / (rho_[newest] * (y_[newest].view() * y_[newest]));
+    }
+
+    for (std::size_t k = 0; k < stored_; ++k) {
+        std::size_t i = (next_ + memory_ - stored_ + k) % memory_;
+        double beta = rho_[i] * (y_[i].view() * direction_);
+        direction_.view().axpy(alpha_[i] - beta, s_[i]);
+    }
+    direction_.view() *= -1;
+}
+
+double LbfgsStrategy::try_step(Objective &objective, const std::vector<double> &point, double alpha)
+{
+    for (std::size_t i = 0; i < point.size(); ++i) {
+        trial_[i] = point[i] + alpha * direction_[i];
+    }
+
+    return objective.evaluate(trial_, trial_gradient_);
+}
+
+bool LbfgsStrategy::line_search(Objective &objective, const std::vector<double> &point, double loss, double slope, double alpha, double &trial_loss)
+{
+    double previous = 0;
+    double previous_loss = loss;
+    for (int i = 0; i < 20; ++i, alpha *= 2) {
+        double f = try_step(objective, point, alpha);
+        if (!std::isfinite(f) || f > loss + c1_ * alpha * slope || (i > 0 && f >= previous_loss)) {
+            return zoom(objective, point, loss, slope, previous, alpha, previous_loss, trial_loss);
+        }
+
+        double d = trial_gradient_.view() * direction_;
+        if (std::abs(d) <= -c2_ * slope) {
+            trial_loss = f;
+            return true;
+        }
+        if (d >= 0) {
+            return zoom(objective, point, loss, slope, alpha, previous, f, trial_loss);
+        }
+        previous = alpha;
+        previous_loss = f;
+    }
+
+    // still going down after doubling 20 times, the last step decreased the loss enough
+    trial_loss = previous_loss;
+    return true;
+}
+
+// bisection of [lo, hi], lo always has sufficient decrease and the lowest loss seen
+bool LbfgsStrategy::zoom(Objective &objective, const std::vector<double> &point, double loss, double slope,
+                         double lo, double hi, double loss_lo, double &trial_loss)
+{
+    for (int j = 0; j < 40; ++j) {
+        double alpha = (lo + hi) / 2;
+        double f = try_step(objective, point, alpha);
+        if (!std::isfinite(f) || f > loss + c1_ * alpha * slope || f >= loss_lo) {
+            hi = alpha;
+            continue;
+        }
+
+        double d = trial_gradient_.view() * direction_;
+        if (std::abs(d) <= -c2_ * slope) {
+            trial_loss = f;
+            return true;
+        }
+        if (d * (hi - lo) >= 0) {
+            hi = lo;
+        }
+        lo = alpha;
+        loss_lo = f;
+    }
+
+    // no point meets the curvature condition, lo still lowers the loss
+    if (lo > 0) {
+        trial_loss = try_step(objective, point, lo);
+        return true;
+    }
+
+    return false;
+}
+
+bool LbfgsStrategy::step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient)
+{
+    const double norm = std::sqrt(gradient * gradient);
+    if (norm == 0) {
+        return false;
+    }
+
+    two_loop(gradient);
+    double slope = direction_.view() * gradient;
+    if (slope >= 0) {
+        stored_ = 0;
+        next_ = 0;
+        two_loop(gradient);
+        slope = -norm * norm;
+    }
+
+    // without pairs the direction is -gradient, the first trial moves by at most one
+    double trial_loss = loss;
+    if (!line_search(objective, point, loss, slope, stored_ > 0 ? 1 : std::min(1.0, 1 / norm), trial_loss)) {
+        if (stored_ == 0) {
+            return false;
+        }
+        // the pairs led astray, start over from steepest descent
+        stored_ = 0;
+        next_ = 0;
+        return step(objective, point, loss, gradient);
+    }
+
+    Grad<double> &s = s_[next_];
+    Grad<double> &y = y_[next_];
+    for (std::size_t i = 0; i < point.size(); ++i) {
+        s[i] = trial_[i] - point[i];
+        y[i] = trial_gradient_[i] - gradient[i];
+    }
+    double sy = s.view() * y;
+    if (sy > 0) {
+        rho_[next_] = 1 / sy;
+        next_ = (next_ + 1) % memory_;
+        stored_ = std::min(stored_ + 1, memory_);
+    }
+
+    point.swap(trial_);
+    std::swap(gradient, trial_gradient_);
+    loss = trial_loss;
+    return true;
+}
@@ -0,0 +1,119 @@
+#ifndef OPTIMIZERSTRATEGY_H
+#define OPTIMIZERSTRATEGY_H
+
+#include "grad.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// The update rules Optimizer can run. They see the loss only through an Objective,
+// allocate their buffers once at construction and work in place afterwards.
+
+enum class OptimizerMethod
+{
+    adam,             // lr, beta_1, beta_2 of the Optimizer
+    lbfgs,            // quasi-Newton, strong Wolfe line search, ignores the rates
+    nesterov,         // momentum with look-ahead, lr and beta_1 as momentum
+    rmsprop,          // lr and beta_2 as decay of the mean square
+    gradient_descent  // Armijo backtracking from the last accepted step, ignores the rates
+};
+
+class Objective
+{
+public:
+    virtual ~Objective() = default;
+    // loss at point, its gradient into gradient
+    virtual double evaluate(const std::vector<double> &point, GradView<double> gradient) = 0;
+};
+
+class OptimizerStrategy
+{
+public:
+    virtual ~OptimizerStrategy() = default;
+    // moves point downhill, loss and gradient hold the values at point before and after.
+    // Returns false when no step lowers the loss, the point is unchanged then
+    virtual bool step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient) = 0;
+};
+
+std::unique_ptr<OptimizerStrategy> make_strategy(OptimizerMethod method, std::size_t size, double lr, double beta_1, double beta_2);
+
+class AdamStrategy : public OptimizerStrategy
+{
+    Grad<double> moment_;
+    Grad<double> v_;
+    Grad<double> step_;
+    double lr_;
+    double beta_1_;
+    double beta_2_;
+    double t_beta_1_;
+    double t_beta_2_;
+    double eps{1e-8};
+public:
+    AdamStrategy(std::size_t size, double lr = 1e-3, double beta_1 = 0.9, double beta_2 = 0.999);
+    bool step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient) override;
+};
+
+class NesterovStrategy : public OptimizerStrategy
+{
+    Grad<double> velocity_;
+    double lr_;
+    double momentum_;
+public:
+    NesterovStrategy(std::size_t size, double lr = 1e-3, double momentum = 0.9);
+    bool step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient) override;
+};
+
+class RmspropStrategy : public OptimizerStrategy
+{
+    Grad<double> square_;
+    double lr_;
+    double decay_;
+    double eps{1e-8};
+public:
+    RmspropStrategy(std::size_t size, double lr = 1e-3, double decay = 0.9);
+    bool step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient) override;
+};
+
+class GradientDescentStrategy : public OptimizerStrategy
+{
+    std::vector<double> trial_;
+    Grad<double> trial_gradient_;
+    double alpha_{1};
+    double c1_{1e-4};
+public:
+    GradientDescentStrategy(std::size_t size);
+    bool step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient) override;
+};
+
+// Limited memory BFGS: the last memory pairs of steps and gradient changes stand in for the
+// inverse Hessian in the two-loop recursion, the step length satisfies the strong Wolfe conditions
+// (Nocedal & Wright, algorithms 7.4, 3.5 and 3.6).
+class LbfgsStrategy : public OptimizerStrategy
+{
+    std::size_t memory_;
+    std::vector<Grad<double>> s_;   // ring buffers of the pairs
+    std::vector<Grad<double>> y_;
+    std::vector<double> rho_;
+    std::vector<double> alpha_;
+    std::size_t stored_{0};
+    std::size_t next_{0};
+    Grad<double> direction_;
+    std::vector<double> trial_;
+    Grad<double> trial_gradient_;
+    double c1_{1e-4};
+    double c2_{0.9};
+public:
+    LbfgsStrategy(std::size_t size, std::size_t memory = 8);
+    bool step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient) override;
+private:
+    // direction = -H gradient
+    void two_loop(const Grad<double> &gradient);
+    // step length along direction_, the accepted point is left in trial_ and trial_gradient_ with its loss in trial_loss
+    bool line_search(Objective &objective, const std::vector<double> &point, double loss, double slope, double alpha, double &trial_loss);
+    double try_step(Objective &objective, const std::vector<double> &point, double alpha);
+    bool zoom(Objective &objective, const std::vector<double> &point, double loss, double slope,
+              double lo, double hi, double loss_lo, double &trial_loss);
+};
+
+#endif // OPTIMIZERSTRATEGY_H
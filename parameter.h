@@ -4,11 +4,11 @@
 #include <string>
 #include <mutex>
 
-class Var;
+class Differentiable;
 
 class Parameter
 {
-    friend class Var;
+    friend class Differentiable;
 
     double value_;
     bool is_diff_;
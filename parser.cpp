@@ -0,0 +1,178 @@
+#include "parser.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <charconv>
+
+
+Parser::Parser()
+{
+    add_token("(", 1, nullptr);
+    add_token(")", 6, nullptr);
+    add_token("sin", 2, std::make_shared<SingleArgFunction<Sin>>());
+    add_token("cos", 2, std::make_shared<SingleArgFunction<Cos>>());
+    add_token("^", 3, std::make_shared<TwoArgFunction<Pow>>());
+    add_token("*", 4, std::make_shared<TwoArgFunction<Mul>>());
+    add_token("/", 4, std::make_shared<TwoArgFunction<Dev>>());
+    add_token("+", 5, std::make_shared<TwoArgFunction<Plus>>());
+    add_token("-", 5, std::make_shared<TwoArgFunction<Sub>>());
+}
+
+void Parser::add_token(std::string_view name, int range, std::shared_ptr<StackProcessor> processor)
+{
+    ids_.insert({name, tokens_.size()});
+    tokens_.push_back({range, std::move(processor)});
+}
+
+void Parser::add_variables(std::string_view variables)
+{
+    std::string_view var;
+    while (next_word(variables, var)) {
+        if (token_of(var) != no_token) {
+            continue;
+        }
+        names_.emplace_back(var);
+        auto param = std::make_shared<Parameter>(0, true, names_.back());
+        add_token(names_.back(), 0, std::make_shared<ParameterClassifier>(param));
+        variables_.push_back(param);
+    }
+}
+
+const std::vector<std::shared_ptr<Parameter>>& Parser::get_variables()
+{
+    return variables_;
+}
+
+std::size_t Parser::token_of(std::string_view word) const
+{
+    auto it = ids_.find(word);
+    if (it == ids_.end()) {
+        return no_token;
+    }
+
+    return it->second;
+}
+
+void Parser::apply(std::size_t token, std::stack<std::shared_ptr<Differentiable>> &s, NodeFactory &factory)
+{
+    tokens_[token].processor->operator()(s, factory);
+}
+
+std::shared_ptr<Differentiable> Parser::make_single_equation(std::string_view equation, NodeFactory &factory)
+{
+    std::stack<std::shared_ptr<Differentiable>> s{};
+    operators_.clear();
+
+    std::string_view word;
+    while (next_word(equation, word)) {
+        std::size_t token = token_of(word);
+        if (token == no_token) {
+            s.push(factory.constant(to_const(word)));
+            continue;
+        }
+
+        int range = tokens_[token].range;
+        if (range == 0) {
+            apply(token, s, factory);
+        } else if (token == close_token) {
+            while (!operators_.empty() && operators_.back() != open_token) {
+                apply(operators_.back(), s, factory);
+                operators_.pop_back();
+            }
+
+            if (operators_.empty()) {
+                throw std::string{"invalid exp"};
+            }
+            operators_.pop_back();
+        } else {
+            while (!operators_.empty() && operators_.back() != open_token && tokens_[operators_.back()].range <= range) {
+                apply(operators_.back(), s, factory);
+                operators_.pop_back();
+            }
+
+            operators_.push_back(token);
+        }
+    }
+
+    while (!operators_.empty() && operators_.back() != open_token) {
+        apply(operators_.back(), s, factory);
+        operators_.pop_back();
+    }
+
+    if (!operators_.empty() || s.size() != 1) {
+        throw std::string{"invalid exp"};
+    }
+
+    return s.top();
+}
+
+std::shared_ptr<Differentiable> Parser::make_equation(std::string_view equations)
+{
+    Profiler::Timer timer(ProfilePhase::parse);
+    NodeFactory factory;
+    std::shared_ptr<Differentiable> result{};
+    for (auto &x : make_residuals(equations, factory)) {
+        auto addition = factory.make<Mul>(x, x);
+        result = result ? factory.make<Plus>(std::move(result), std::move(addition)) : std::move(addition);
+    }
+
+    return result;
+}
+
+std::vector<std::shared_ptr<Differentiable>> Parser::make_residuals(std::string_view equations)
+{
+    Profiler::Timer timer(ProfilePhase::parse);
+    NodeFactory factory;
+    return make_residuals(equations, factory);
+}
+
+std::vector<std::shared_ptr<Differentiable>> Parser::make_residuals(std::string_view equations, NodeFactory &factory)
+{
+    std::vector<std::shared_ptr<Differentiable>> residuals{};
+    while (!equations.empty()) {
+        std::size_t end = equations.find('\n');
+        std::string_view line = equations.substr(0, end);
+        equations.remove_prefix(end == std::string_view::npos ? equations.size() : end + 1);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        residuals.push_back(make_single_equation(line, factory));
+    }
+
+    if (residuals.empty()) {
+        throw std::string{"no equations"};
+    }
+
+    return residuals;
+}
+
+bool Parser::next_word(std::string_view &s, std::string_view &word)
+{
+    std::size_t begin = s.find_first_not_of(' ');
+    if (begin == std::string_view::npos) {
+        s = {};
+        return false;
+    }
+
+    std::size_t end = std::min(s.find(' ', begin), s.size());
+    word = s.substr(begin, end - begin);
+    s.remove_prefix(end);
+
+    return true;
+}
+
+double Parser::to_const(std::string_view word)
+{
+    if (word.size() > 1 && word[0] == '+') {
+        word.remove_prefix(1);
+    }
+
+    double c = 0;
+    auto [ptr, ec] = std::from_chars(word.data(), word.data() + word.size(), c);
+    if (ec != std::errc() || ptr != word.data() + word.size()) { // в слове нет мусора
+        throw std::string{"invalid const"};
+    }
+
+    return c;
+}
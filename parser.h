@@ -0,0 +1,57 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "stackprocessor.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+// Text of a system into one Differentiable, the sum of squares of its equations.
+// Words are separated by spaces, every line that is not empty and not a comment is an equation.
+// One pass over the text: words are looked up as interned token ids and the shunting-yard
+// loop builds the nodes as soon as an operator leaves its stack.
+class Parser
+{
+    static constexpr std::size_t no_token = static_cast<std::size_t>(-1);
+    static constexpr std::size_t open_token = 0;
+    static constexpr std::size_t close_token = 1;
+
+    struct Token
+    {
+        int range; // 0 for variables, a lower range binds tighter
+        std::shared_ptr<StackProcessor> processor;
+    };
+
+    std::vector<Token> tokens_{};
+    std::unordered_map<std::string_view, std::size_t> ids_{}; // views into names_ or literals
+    std::deque<std::string> names_{};
+    std::vector<std::shared_ptr<Parameter>> variables_{};
+    std::vector<std::size_t> operators_{};
+public:
+    Parser();
+    Parser(const Parser&) = delete;
+    Parser& operator=(const Parser&) = delete;
+
+    void add_variables(std::string_view variables);
+    const std::vector<std::shared_ptr<Parameter>>& get_variables();
+    std::shared_ptr<Differentiable> make_equation(std::string_view equations);
+    // the left-hand sides of the equations one by one, not squared
+    std::vector<std::shared_ptr<Differentiable>> make_residuals(std::string_view equations);
+
+    // cuts the next space separated word from s, false when only spaces are left
+    static bool next_word(std::string_view &s, std::string_view &word);
+private:
+    void add_token(std::string_view name, int range, std::shared_ptr<StackProcessor> processor);
+    std::size_t token_of(std::string_view word) const;
+    void apply(std::size_t token, std::stack<std::shared_ptr<Differentiable>> &s, NodeFactory &factory);
+    std::shared_ptr<Differentiable> make_single_equation(std::string_view equation, NodeFactory &factory);
+    std::vector<std::shared_ptr<Differentiable>> make_residuals(std::string_view equations, NodeFactory &factory);
+    static double to_const(std::string_view word);
+};
+
+#endif // PARSER_H
@@ -0,0 +1,99 @@
+#include "profiler.h"
+
+#include <cstdio>
+
+
+std::array<std::atomic<std::uint64_t>, Profile::counters> Profiler::counters_{};
+std::array<std::atomic<std::uint64_t>, Profile::phases> Profiler::nanoseconds_{};
+
+namespace {
+
+constexpr const char *counter_names[Profile::counters] = {
+    "nodes_built", "node_evaluations", "gradient_calls", "iterations", "arena_blocks", "arena_bytes"
+};
+
+constexpr const char *phase_names[Profile::phases] = {
+    "parse", "compile", "gradient", "solve"
+};
+
+} // namespace
+
+
+Profile Profile::operator-(const Profile &other) const
+{
+    Profile result;
+    for (std::size_t i = 0; i < counters; ++i) {
+        result.counter[i] = counter[i] - other.counter[i];
+    }
+    for (std::size_t i = 0; i < phases; ++i) {
+        result.nanoseconds[i] = nanoseconds[i] - other.nanoseconds[i];
+    }
+
+    return result;
+}
+
+Profile Profile::operator+(const Profile &other) const
+{
+    Profile result;
+    for (std::size_t i = 0; i < counters; ++i) {
+        result.counter[i] = counter[i] + other.counter[i];
+    }
+    for (std::size_t i = 0; i < phases; ++i) {
+        result.nanoseconds[i] = nanoseconds[i] + other.nanoseconds[i];
+    }
+
+    return result;
+}
+
+std::string Profile::to_json() const
+{
+    std::string s = std::string{"{\"enabled\":"} + (Profiler::enabled ? "true" : "false") + ",\"counters\":{";
+    for (std::size_t i = 0; i < counters; ++i) {
+        s += (i ? ",\"" : "\"") + std::string{counter_names[i]} + "\":" + std::to_string(counter[i]);
+    }
+
+    auto text = [] (double seconds) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.9f", seconds);
+        return std::string{buf};
+    };
+
+    s += "},\"seconds\":{";
+    for (std::size_t i = 0; i < phases; ++i) {
+        s += (i ? ",\"" : "\"") + std::string{phase_names[i]} + "\":" + text(nanoseconds[i] * 1e-9);
+    }
+    s += ",\"update\":" + text(update_seconds());
+
+    return s + "}}";
+}
+
+Profile Profiler::snapshot()
+{
+    Profile result;
+    if constexpr (enabled) {
+        for (std::size_t i = 0; i < Profile::counters; ++i) {
+            result.counter[i] = counters_[i].load(std::memory_order_relaxed);
+        }
+        for (std::size_t i = 0; i < Profile::phases; ++i) {
+            result.nanoseconds[i] = nanoseconds_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    return result;
+}
+
+#ifdef AUTODIFF_PROFILE
+thread_local std::array<unsigned, Profile::phases> Profiler::Timer::depth_{};
+
+Profiler::Timer::Timer(ProfilePhase phase)
+    : phase_(phase), outer_(depth_[static_cast<std::size_t>(phase)]++ == 0), start_(std::chrono::steady_clock::now()) {}
+
+Profiler::Timer::~Timer()
+{
+    --depth_[static_cast<std::size_t>(phase_)];
+    if (outer_) {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        add_time(phase_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+}
+#endif
@@ -0,0 +1,118 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Process-wide counters and phase timers of the engine, built in only with AUTODIFF_PROFILE defined
+// (the CMake option of the same name). Without it every call is an empty inline function.
+// A Profile is a snapshot, the difference of two snapshots covers what happened in between
+// in the whole process. Model measures the parsing of a solve and its run in the dispatcher apart
+// and adds them, work of other threads at the same time, like parsing the next queued solve, still counts.
+
+enum class ProfileCounter
+{
+    nodes_built,      // Differentiable nodes constructed
+    node_evaluations, // tape instructions executed by value sweeps
+    gradient_calls,   // gradients, Jacobians and Hessian-vector products
+    iterations,       // steps of the solvers
+    arena_blocks,     // memory blocks of NodeArena
+    arena_bytes,      // node memory taken from the arenas
+    count
+};
+
+enum class ProfilePhase
+{
+    parse,   // text to nodes
+    compile,  // nodes to tapes
+    gradient, // gradients, Jacobians and Hessian-vector products, also inside solve
+    solve,    // solvers: their gradients and the updates of the point, see Profile::update_seconds
+    count
+};
+
+struct Profile
+{
+    static constexpr std::size_t counters = static_cast<std::size_t>(ProfileCounter::count);
+    static constexpr std::size_t phases = static_cast<std::size_t>(ProfilePhase::count);
+
+    std::array<std::uint64_t, counters> counter{};
+    std::array<std::uint64_t, phases> nanoseconds{};
+
+    std::uint64_t operator[](ProfileCounter c) const
+    {
+        return counter[static_cast<std::size_t>(c)];
+    }
+
+    double seconds(ProfilePhase phase) const
+    {
+        return nanoseconds[static_cast<std::size_t>(phase)] * 1e-9;
+    }
+
+    // time of the solvers outside the gradients: steps, line searches, linear algebra
+    double update_seconds() const
+    {
+        double update = seconds(ProfilePhase::solve) - seconds(ProfilePhase::gradient);
+        return update > 0 ? update : 0;
+    }
+
+    Profile operator-(const Profile &other) const;
+    Profile operator+(const Profile &other) const;
+    // one line: {"enabled":..,"counters":{..},"seconds":{..,"update":..}}
+    std::string to_json() const;
+};
+
+class Profiler
+{
+    static std::array<std::atomic<std::uint64_t>, Profile::counters> counters_;
+    static std::array<std::atomic<std::uint64_t>, Profile::phases> nanoseconds_;
+public:
+#ifdef AUTODIFF_PROFILE
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    static void add(ProfileCounter c, std::uint64_t n = 1)
+    {
+        if constexpr (enabled) {
+            counters_[static_cast<std::size_t>(c)].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    static void add_time(ProfilePhase phase, std::uint64_t nanoseconds)
+    {
+        if constexpr (enabled) {
+            nanoseconds_[static_cast<std::size_t>(phase)].fetch_add(nanoseconds, std::memory_order_relaxed);
+        }
+    }
+
+    // all zeros when disabled
+    static Profile snapshot();
+
+    // adds its lifetime to phase, nested timers of the same phase count once
+    class Timer
+    {
+#ifdef AUTODIFF_PROFILE
+        ProfilePhase phase_;
+        bool outer_;
+        std::chrono::steady_clock::time_point start_;
+        static thread_local std::array<unsigned, Profile::phases> depth_;
+#endif
+    public:
+        Timer(ProfilePhase phase);
+        ~Timer();
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+    };
+};
+
+#ifndef AUTODIFF_PROFILE
+inline Profiler::Timer::Timer(ProfilePhase) {}
+inline Profiler::Timer::~Timer() {}
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,221 @@
+#include "residuals.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+
+void SparseMatrix::multiply(const double *x, double *y) const
+{
+    for (std::size_t i = 0; i < rows; ++i) {
+        double sum = 0;
+        for (std::size_t k = row_start[i]; k < row_start[i + 1]; ++k) {
+            sum += values[k] * x[columns[k]];
+        }
+        y[i] = sum;
+    }
+}
+
+void SparseMatrix::multiply_transposed(const double *x, double *y) const
+{
+    std::fill_n(y, cols, 0.0);
+    for (std::size_t i = 0; i < rows; ++i) {
+        for (std::size_t k = row_start[i]; k < row_start[i + 1]; ++k) {
+            y[columns[k]] += values[k] * x[i];
+        }
+    }
+}
+
+std::size_t SparseMatrix::color_columns(std::vector<std::size_t> &colors) const
+{
+    constexpr std::size_t none = static_cast<std::size_t>(-1);
+
+    std::vector<std::vector<std::size_t>> rows_of(cols);
+    for (std::size_t i = 0; i < rows; ++i) {
+        for (std::size_t k = row_start[i]; k < row_start[i + 1]; ++k) {
+            rows_of[columns[k]].push_back(i);
+        }
+    }
+
+    std::vector<std::size_t> order(cols);
+    for (std::size_t j = 0; j < cols; ++j) {
+        order[j] = j;
+    }
+    std::stable_sort(order.begin(), order.end(), [&rows_of] (std::size_t a, std::size_t b) {
+        return rows_of[a].size() > rows_of[b].size();
+    });
+
+    colors.assign(cols, none);
+    std::vector<std::size_t> used_by(cols, none); // used_by[c] == j: color c is taken by a neighbour of column j
+    std::size_t count = 0;
+    for (std::size_t j : order) {
+        for (std::size_t i : rows_of[j]) {
+            for (std::size_t k = row_start[i]; k < row_start[i + 1]; ++k) {
+                if (colors[columns[k]] != none) {
+                    used_by[colors[columns[k]]] = j;
+                }
+            }
+        }
+
+        std::size_t c = 0;
+        while (used_by[c] == j) {
+            ++c;
+        }
+        colors[j] = c;
+        count = std::max(count, c + 1);
+    }
+
+    return count;
+}
+
+
+Residuals::Residuals(const std::vector<std::shared_ptr<Differentiable>> &equations, std::vector<std::shared_ptr<Parameter>> parameters, DiffMode mode)
+    : parameters_(std::move(parameters)), mode_(mode)
+{
+    Profiler::Timer timer(ProfilePhase::compile);
+    std::map<Parameter*, std::size_t> index;
+    for (std::size_t j = 0; j < parameters_.size(); ++j) {
+        index.insert({parameters_[j].get(), j});
+    }
+
+    // the order of get_all_parameters is the order of the gradient of a Tape of the equation
+    for (auto &x : equations) {
+        std::vector<std::shared_ptr<Parameter>> used;
+        x->get_all_parameters(used);
+        for (auto &p : used) {
+            auto it = index.find(p.get());
+            if (it == index.end()) {
+                it = index.insert({p.get(), parameters_.size()}).first;
+                parameters_.push_back(p);
+            }
+            pattern_.columns.push_back(it->second);
+        }
+        pattern_.row_start.push_back(pattern_.columns.size());
+    }
+
+    pattern_.rows = equations.size();
+    pattern_.cols = parameters_.size();
+    pattern_.values.assign(pattern_.columns.size(), 0);
+
+    if (mode_ == DiffMode::reverse) {
+        tapes_.reserve(equations.size());
+        for (auto &x : equations) {
+            tapes_.emplace_back(x);
+        }
+        return;
+    }
+
+    if (equations.empty()) {
+        throw std::string{"no equations"};
+    }
+    tapes_.emplace_back(equations[0], parameters_);
+    outputs_.push_back(tapes_[0].size() - 1);
+    for (std::size_t i = 1; i < equations.size(); ++i) {
+        outputs_.push_back(tapes_[0].compile(equations[i]));
+    }
+
+    entries_of_color_.resize(pattern_.color_columns(colors_));
+    for (std::size_t i = 0; i < pattern_.rows; ++i) {
+        for (std::size_t k = pattern_.row_start[i]; k < pattern_.row_start[i + 1]; ++k) {
+            entries_of_color_[colors_[pattern_.columns[k]]].push_back(k);
+            row_of_entry_.push_back(i);
+        }
+    }
+}
+
+ResidualState Residuals::make_state() const
+{
+    ResidualState state;
+    for (auto &x : parameters_) {
+        state.point.push_back(x->get_value());
+    }
+    for (auto &x : tapes_) {
+        state.tapes.push_back(x.make_state());
+    }
+    state.seed.assign(parameters_.size(), 0);
+
+    return state;
+}
+
+void Residuals::scatter(ResidualState &state) const
+{
+    if (state.point.size() != parameters_.size() || state.tapes.size() != tapes_.size()) {
+        throw std::string{"invalid point"};
+    }
+
+    if (mode_ == DiffMode::forward) {
+        state.tapes[0].point = state.point;
+        return;
+    }
+
+    for (std::size_t i = 0; i < tapes_.size(); ++i) {
+        double *point = state.tapes[i].point.data();
+        for (std::size_t k = pattern_.row_start[i]; k < pattern_.row_start[i + 1]; ++k) {
+            point[k - pattern_.row_start[i]] = state.point[pattern_.columns[k]];
+        }
+    }
+}
+
+void Residuals::evaluate(ResidualState &state, double *residuals) const
+{
+    scatter(state);
+    if (mode_ == DiffMode::forward) {
+        tapes_[0](state.tapes[0]);
+        for (std::size_t i = 0; i < outputs_.size(); ++i) {
+            residuals[i] = state.tapes[0].values[outputs_[i]];
+        }
+        return;
+    }
+
+    for (std::size_t i = 0; i < tapes_.size(); ++i) {
+        residuals[i] = tapes_[i](state.tapes[i]);
+    }
+}
+
+void Residuals::jacobian(ResidualState &state, double *residuals, SparseMatrix &jacobian) const
+{
+    Profiler::add(ProfileCounter::gradient_calls);
+    Profiler::Timer timer(ProfilePhase::gradient);
+    if (mode_ == DiffMode::forward) {
+        evaluate(state, residuals);
+        TapeState &tape_state = state.tapes[0];
+        for (std::size_t c = 0; c < entries_of_color_.size(); ++c) {
+            for (std::size_t j = 0; j < parameters_.size(); ++j) {
+                state.seed[j] = colors_[j] == c;
+            }
+            tapes_[0].directional(tape_state, state.seed.data());
+            for (std::size_t k : entries_of_color_[c]) {
+                jacobian.values[k] = tape_state.derivatives[outputs_[row_of_entry_[k]]];
+            }
+        }
+        return;
+    }
+
+    scatter(state);
+    for (std::size_t i = 0; i < tapes_.size(); ++i) {
+        const std::size_t first = pattern_.row_start[i];
+        tapes_[i].make_grad(state.tapes[i], GradView<double>(jacobian.values.data() + first, pattern_.row_start[i + 1] - first));
+        residuals[i] = state.tapes[i].get_value();
+    }
+}
+
+const SparseMatrix& Residuals::pattern() const
+{
+    return pattern_;
+}
+
+std::size_t Residuals::size() const
+{
+    return pattern_.rows;
+}
+
+std::size_t Residuals::sweeps() const
+{
+    return mode_ == DiffMode::reverse ? pattern_.rows : entries_of_color_.size();
+}
+
+const std::vector<std::shared_ptr<Parameter>>& Residuals::get_parameters() const
+{
+    return parameters_;
+}
@@ -0,0 +1,76 @@
+#ifndef RESIDUALS_H
+#define RESIDUALS_H
+
+#include "differentiable.h"
+#include "parameter.h"
+#include "tape.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+
+// Compressed rows: the entries of row i are columns[row_start[i]] ... columns[row_start[i + 1] - 1]
+struct SparseMatrix
+{
+    std::size_t rows{0};
+    std::size_t cols{0};
+    std::vector<std::size_t> row_start{0};
+    std::vector<std::size_t> columns{};
+    std::vector<double> values{};
+
+    // y = A * x
+    void multiply(const double *x, double *y) const;
+    // y = A^T * x
+    void multiply_transposed(const double *x, double *y) const;
+    // greedy coloring of the columns, columns with an entry in the same row get different colors,
+    // columns are taken by decreasing count of entries. Returns the number of colors
+    std::size_t color_columns(std::vector<std::size_t> &colors) const;
+};
+
+struct ResidualState
+{
+    std::vector<double> point{}; // one value per parameter of the system
+    std::vector<TapeState> tapes{};
+    std::vector<double> seed{};
+};
+
+// Equations of a system kept apart instead of summed as squares, with a shared order of the parameters.
+// Row i of the Jacobian only has the parameters of equation i. The Jacobian is computed
+//   DiffMode::reverse - one Tape per equation, one reverse sweep per row
+//   DiffMode::forward - one Tape for all equations, one forward sweep per color of the columns:
+//                       parameters that never meet in an equation are seeded together
+class Residuals
+{
+    std::vector<Tape> tapes_{};               // one per equation, or the single shared tape in forward mode
+    std::vector<std::size_t> outputs_{};      // slots of the equations on the shared tape
+    std::vector<std::shared_ptr<Parameter>> parameters_{};
+    SparseMatrix pattern_{};
+    DiffMode mode_;
+    std::vector<std::size_t> colors_{};
+    std::vector<std::vector<std::size_t>> entries_of_color_{}; // entries of the pattern seeded by each color
+    std::vector<std::size_t> row_of_entry_{};
+public:
+    // parameters go first in the given order, parameters of the equations missing there are appended
+    Residuals(const std::vector<std::shared_ptr<Differentiable>> &equations, std::vector<std::shared_ptr<Parameter>> parameters = {},
+              DiffMode mode = DiffMode::reverse);
+
+    // state at the current values of the parameters
+    ResidualState make_state() const;
+
+    // residuals receives size() values at state.point
+    void evaluate(ResidualState &state, double *residuals) const;
+    // evaluates and writes the Jacobian, which must have the structure of pattern()
+    void jacobian(ResidualState &state, double *residuals, SparseMatrix &jacobian) const;
+
+    // structure of the Jacobian, all values are zero
+    const SparseMatrix& pattern() const;
+    std::size_t size() const;
+    const std::vector<std::shared_ptr<Parameter>>& get_parameters() const;
+    // sweeps over a tape per Jacobian
+    std::size_t sweeps() const;
+private:
+    void scatter(ResidualState &state) const;
+};
+
+#endif // RESIDUALS_H
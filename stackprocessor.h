@@ -3,8 +3,10 @@
 
 #include "parameter.h"
 #include "differentiable.h"
+#include "nodefactory.h"
 
 #include <stack>
+#include <string>
 #include <memory>
 
 
@@ -13,7 +15,7 @@ class StackProcessor
 public:
     StackProcessor() = default;
     virtual ~StackProcessor() = default;
-    virtual void operator()(std::stack<std::shared_ptr<Differentiable>> &s) = 0;
+    virtual void operator()(std::stack<std::shared_ptr<Differentiable>> &s, NodeFactory &factory) = 0;
 };
 
 class ParameterClassifier : public StackProcessor
@@ -22,9 +24,9 @@ class ParameterClassifier : public StackProcessor
 public:
     ParameterClassifier(std::shared_ptr<Parameter> param) :  param_(param) {}
     ~ParameterClassifier() = default;
-    void operator()(std::stack<std::shared_ptr<Differentiable>> &s) override
+    void operator()(std::stack<std::shared_ptr<Differentiable>> &s, NodeFactory &factory) override
     {
-        s.push(std::make_shared<Var>(param_));
+        s.push(factory.variable(param_));
     }
 };
 
@@ -34,11 +36,14 @@ class SingleArgFunction : public StackProcessor
 public:
     SingleArgFunction() = default;
     ~SingleArgFunction() = default;
-    void operator()(std::stack<std::shared_ptr<Differentiable>> &s) override
+    void operator()(std::stack<std::shared_ptr<Differentiable>> &s, NodeFactory &factory) override
     {
-        std::shared_ptr<Differentiable> param = s.top();
+        if (s.empty()) {
+            throw std::string{"invalid exp"};
+        }
+        std::shared_ptr<Differentiable> param = std::move(s.top());
         s.pop();
-        s.push(std::make_shared<D>(param));
+        s.push(factory.make<D>(std::move(param)));
     }
 };
 
@@ -49,13 +54,16 @@ class TwoArgFunction : public StackProcessor
 public:
     TwoArgFunction() = default;
     ~TwoArgFunction() = default;
-    void operator()(std::stack<std::shared_ptr<Differentiable>> &s) override
+    void operator()(std::stack<std::shared_ptr<Differentiable>> &s, NodeFactory &factory) override
     {
-        std::shared_ptr<Differentiable> param_2 = s.top();
+        if (s.size() < 2) {
+            throw std::string{"invalid exp"};
+        }
+        std::shared_ptr<Differentiable> param_2 = std::move(s.top());
         s.pop();
-        std::shared_ptr<Differentiable> param_1 = s.top();
+        std::shared_ptr<Differentiable> param_1 = std::move(s.top());
         s.pop();
-        s.push(std::make_shared<D>(param_1, param_2));
+        s.push(factory.make<D>(std::move(param_1), std::move(param_2)));
     }
 };
 
@@ -0,0 +1,411 @@
+#ifndef STATICEXPR_H
+#define STATICEXPR_H
+
+#include "differentiable.h"
+#include "grad.h"
+#include "nodefactory.h"
+#include "parameter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Expression templates: the operations of std::shared_ptr<Differentiable> built as types, for objectives known
+// at compile time. An expression is a value of a few bytes, value and gradient inline into straight-line code
+// without allocations. Variable I reads point[I]:
+//
+//     constexpr auto x = static_var<0>;
+//     constexpr auto y = static_var<1>;
+//     constexpr auto f = d_pow(1.0 - x, 2.0) + 100.0 * d_pow(y - x * x, 2.0);
+//     double loss = f.make_grad(point, gradient);
+//
+// The gradient recomputes the values of the arguments instead of storing them, the compiler merges the copies.
+// to_differentiable() makes the same nodes by a NodeFactory, for Tape and the optimizers.
+
+template<typename E>
+class StaticExpr
+{
+public:
+    constexpr const E& self() const
+    {
+        return static_cast<const E&>(*this);
+    }
+
+    constexpr double operator()(const double *point) const
+    {
+        return self().value(point);
+    }
+
+    // gradient has E::size elements, returns the value. Throws when gradient is shorter
+    double make_grad(const double *point, GradView<double> gradient) const
+    {
+        if (gradient.size() < E::size) {
+            throw std::string{"invalid gradient"};
+        }
+
+        gradient *= 0;
+        self().propagate(point, 1, gradient.data());
+
+        return self().value(point);
+    }
+
+    // throws when point is shorter than E::size
+    Grad<double> make_grad(const std::vector<double> &point) const
+    {
+        if (point.size() < E::size) {
+            throw std::string{"invalid point"};
+        }
+
+        Grad<double> gradient(std::vector<double>(E::size, 0));
+        self().propagate(point.data(), 1, gradient.view().data());
+
+        return gradient;
+    }
+
+    // nodes of a new NodeFactory, variable I becomes parameters[I]
+    std::shared_ptr<Differentiable> to_differentiable(const std::vector<std::shared_ptr<Parameter>> &parameters) const
+    {
+        if (parameters.size() < E::size) {
+            throw std::string{"invalid parameters"};
+        }
+
+        NodeFactory factory;
+        return self().rebuild(factory, parameters);
+    }
+};
+
+template<typename T>
+constexpr bool is_static_expr = std::is_base_of_v<StaticExpr<T>, T>;
+
+
+class StaticConst : public StaticExpr<StaticConst>
+{
+    double c_;
+public:
+    static constexpr std::size_t size = 0;
+
+    constexpr StaticConst(double c) : c_(c) {}
+
+    constexpr double value(const double *) const
+    {
+        return c_;
+    }
+
+    constexpr void propagate(const double *, double, double *) const {/*Empty*/}
+
+    std::shared_ptr<Differentiable> rebuild(NodeFactory &factory, const std::vector<std::shared_ptr<Parameter>> &) const
+    {
+        return factory.constant(c_);
+    }
+};
+
+template<std::size_t I>
+class StaticVar : public StaticExpr<StaticVar<I>>
+{
+public:
+    static constexpr std::size_t size = I + 1;
+
+    constexpr double value(const double *point) const
+    {
+        return point[I];
+    }
+
+    constexpr void propagate(const double *, double adjoint, double *gradient) const
+    {
+        gradient[I] += adjoint;
+    }
+
+    std::shared_ptr<Differentiable> rebuild(NodeFactory &factory, const std::vector<std::shared_ptr<Parameter>> &parameters) const
+    {
+        return factory.variable(parameters.at(I));
+    }
+};
+
+template<std::size_t I>
+constexpr StaticVar<I> static_var{};
+
+
+//Functions
+
+template<typename X, typename Y>
+class StaticPlus : public StaticExpr<StaticPlus<X, Y>>
+{
+    X x_;
+    Y y_;
+public:
+    static constexpr std::size_t size = std::max(X::size, Y::size);
+
+    constexpr StaticPlus(X x, Y y) : x_(x), y_(y) {}
+
+    constexpr double value(const double *point) const
+    {
+        return x_.value(point) + y_.value(point);
+    }
+
+    constexpr void propagate(const double *point, double adjoint, double *gradient) const
+    {
+        x_.propagate(point, adjoint, gradient);
+        y_.propagate(point, adjoint, gradient);
+    }
+
+    std::shared_ptr<Differentiable> rebuild(NodeFactory &factory, const std::vector<std::shared_ptr<Parameter>> &parameters) const
+    {
+        return factory.make<Plus>(x_.rebuild(factory, parameters), y_.rebuild(factory, parameters));
+    }
+};
+
+template<typename X, typename Y>
+class StaticSub : public StaticExpr<StaticSub<X, Y>>
+{
+    X x_;
+    Y y_;
+public:
+    static constexpr std::size_t size = std::max(X::size, Y::size);
+
+    constexpr StaticSub(X x, Y y) : x_(x), y_(y) {}
+
+    constexpr double value(const double *point) const
+    {
+        return x_.value(point) - y_.value(point);
+    }
+
+    constexpr void propagate(const double *point, double adjoint, double *gradient) const
+    {
+        x_.propagate(point, adjoint, gradient);
+        y_.propagate(point, -adjoint, gradient);
+    }
+
+    std::shared_ptr<Differentiable> rebuild(NodeFactory &factory, const std::vector<std::shared_ptr<Parameter>> &parameters) const
+    {
+        return factory.make<Sub>(x_.rebuild(factory, parameters), y_.rebuild(factory, parameters));
+    }
+};
+
+template<typename X, typename Y>
+class StaticMul : public StaticExpr<StaticMul<X, Y>>
+{
+    X x_;
+    Y y_;
+public:
+    static constexpr std::size_t size = std::max(X::size, Y::size);
+
+    constexpr StaticMul(X x, Y y) : x_(x), y_(y) {}
+
+    constexpr double value(const double *point) const
+    {
+        return x_.value(point) * y_.value(point);
+    }
+
+    constexpr void propagate(const double *point, double adjoint, double *gradient) const
+    {
+        x_.propagate(point, adjoint * y_.value(point), gradient);
+        y_.propagate(point, adjoint * x_.value(point), gradient);
+    }
+
+    std::shared_ptr<Differentiable> rebuild(NodeFactory &factory, const std::vector<std::shared_ptr<Parameter>> &parameters) const
+    {
+        return factory.make<Mul>(x_.rebuild(factory, parameters), y_.rebuild(factory, parameters));
+    }
+};
+
+template<typename X, typename Y>
+class StaticDev : public StaticExpr<StaticDev<X, Y>>
+{
+    X x_;
+    Y y_;
+public:
+    static constexpr std::size_t size = std::max(X::size, Y::size);
+
+    constexpr StaticDev(X x, Y y) : x_(x), y_(y) {}
+
+    constexpr double value(const double *point) const
+    {
+        return x_.value(point) / y_.value(point);
+    }
+
+    constexpr void propagate(const double *point, double adjoint, double *gradient) const
+    {
+        const double y = y_.value(point);
+        x_.propagate(point, adjoint / y, gradient);
+        y_.propagate(point, -adjoint * x_.value(point) / (y * y), gradient);
+    }
+
+    std::shared_ptr<Differentiable> rebuild(NodeFactory &factory, const std::vector<std::shared_ptr<Parameter>> &parameters) const
+    {
+        return factory.make<Dev>(x_.rebuild(factory, parameters), y_.rebuild(factory, parameters));
+    }
+};
+
+// differentiated by the base only, like Pow
+template<typename X, typename N>
+class StaticPow : public StaticExpr<StaticPow<X, N>>
+{
+    X x_;
+    N n_;
+public:
+    static constexpr std::size_t size = std::max(X::size, N::size);
+
+    constexpr StaticPow(X x, N n) : x_(x), n_(n) {}
+
+    double value(const double *point) const
+    {
+        return std::pow(x_.value(point), n_.value(point));
+    }
+
+    void propagate(const double *point, double adjoint, double *gradient) const
+    {
+        const double n = n_.value(point);
+        x_.propagate(point, adjoint * n * std::pow(x_.value(point), n - 1), gradient);
+    }
+
+    std::shared_ptr<Differentiable> rebuild(NodeFactory &factory, const std::vector<std::shared_ptr<Parameter>> &parameters) const
+    {
+        return factory.make<Pow>(x_.rebuild(factory, parameters), n_.rebuild(factory, parameters));
+    }
+};
+
+template<typename X>
+class StaticCos : public StaticExpr<StaticCos<X>>
+{
+    X x_;
+public:
+    static constexpr std::size_t size = X::size;
+
+    constexpr StaticCos(X x) : x_(x) {}
+
+    double value(const double *point) const
+    {
+        return std::cos(x_.value(point));
+    }
+
+    void propagate(const double *point, double adjoint, double *gradient) const
+    {
+        x_.propagate(point, -adjoint * std::sin(x_.value(point)), gradient);
+    }
+
+    std::shared_ptr<Differentiable> rebuild(NodeFactory &factory, const std::vector<std::shared_ptr<Parameter>> &parameters) const
+    {
+        return factory.make<Cos>(x_.rebuild(factory, parameters));
+    }
+};
+
+template<typename X>
+class StaticSin : public StaticExpr<StaticSin<X>>
+{
+    X x_;
+public:
+    static constexpr std::size_t size = X::size;
+
+    constexpr StaticSin(X x) : x_(x) {}
+
+    double value(const double *point) const
+    {
+        return std::sin(x_.value(point));
+    }
+
+    void propagate(const double *point, double adjoint, double *gradient) const
+    {
+        x_.propagate(point, adjoint * std::cos(x_.value(point)), gradient);
+    }
+
+    std::shared_ptr<Differentiable> rebuild(NodeFactory &factory, const std::vector<std::shared_ptr<Parameter>> &parameters) const
+    {
+        return factory.make<Sin>(x_.rebuild(factory, parameters));
+    }
+};
+
+template<typename X>
+class StaticNeg : public StaticExpr<StaticNeg<X>>
+{
+    X x_;
+public:
+    static constexpr std::size_t size = X::size;
+
+    constexpr StaticNeg(X x) : x_(x) {}
+
+    constexpr double value(const double *point) const
+    {
+        return -x_.value(point);
+    }
+
+    constexpr void propagate(const double *point, double adjoint, double *gradient) const
+    {
+        x_.propagate(point, -adjoint, gradient);
+    }
+
+    std::shared_ptr<Differentiable> rebuild(NodeFactory &factory, const std::vector<std::shared_ptr<Parameter>> &parameters) const
+    {
+        return factory.make<Neg>(x_.rebuild(factory, parameters));
+    }
+};
+
+
+//Operators: at least one argument is an expression, numbers become StaticConst
+
+template<typename T>
+constexpr auto as_static(const T &x)
+{
+    if constexpr (std::is_arithmetic_v<T>) {
+        return StaticConst(static_cast<double>(x));
+    } else {
+        return x;
+    }
+}
+
+template<typename X, typename Y>
+using enable_static = std::enable_if_t<(is_static_expr<X> || is_static_expr<Y>)
+    && (is_static_expr<X> || std::is_arithmetic_v<X>) && (is_static_expr<Y> || std::is_arithmetic_v<Y>)>;
+
+template<typename X, typename Y, typename = enable_static<X, Y>>
+constexpr auto operator +(const X &x, const Y &y)
+{
+    return StaticPlus(as_static(x), as_static(y));
+}
+
+template<typename X, typename Y, typename = enable_static<X, Y>>
+constexpr auto operator -(const X &x, const Y &y)
+{
+    return StaticSub(as_static(x), as_static(y));
+}
+
+template<typename X, typename Y, typename = enable_static<X, Y>>
+constexpr auto operator *(const X &x, const Y &y)
+{
+    return StaticMul(as_static(x), as_static(y));
+}
+
+template<typename X, typename Y, typename = enable_static<X, Y>>
+constexpr auto operator /(const X &x, const Y &y)
+{
+    return StaticDev(as_static(x), as_static(y));
+}
+
+template<typename X, typename = std::enable_if_t<is_static_expr<X>>>
+constexpr auto operator -(const X &x)
+{
+    return StaticNeg(x);
+}
+
+template<typename X, typename = std::enable_if_t<is_static_expr<X>>>
+constexpr auto d_sin(const X &x)
+{
+    return StaticSin(x);
+}
+
+template<typename X, typename = std::enable_if_t<is_static_expr<X>>>
+constexpr auto d_cos(const X &x)
+{
+    return StaticCos(x);
+}
+
+template<typename X, typename N, typename = enable_static<X, N>>
+constexpr auto d_pow(const X &x, const N &n)
+{
+    return StaticPow(as_static(x), as_static(n));
+}
+
+#endif // STATICEXPR_H
@@ -0,0 +1,40 @@
+#ifndef STOPCRITERIA_H
+#define STOPCRITERIA_H
+
+#include <chrono>
+
+// When an iterative solver gives up. The run ends at the first criterion met, zero turns a criterion off.
+// Stall detection compares the best loss with the best loss window iterations before,
+// so the noise of Adam does not end a run that still makes progress.
+struct StopCriteria
+{
+    double loss{1e-30};                     // absolute: the system is solved at or below it
+    int max_iterations{50000};
+    double gradient{0};                     // norm of the gradient, the default stops on exact stationary points only
+    int window{0};                          // stall: iterations over which the best loss must improve
+    double relative{1e-4};                  // by at least this fraction of itself
+    std::chrono::nanoseconds deadline{0};   // wall clock per run
+
+    // Near 1e-30 the loss is at the rounding of the residuals and stalls too, so stall detection is off
+    // by default. Solves that accept a far larger loss, like the answers of Model and BatchSolver,
+    // turn it on and give up on systems without a root after a few thousand iterations.
+    static StopCriteria with_stall_detection()
+    {
+        StopCriteria criteria;
+        criteria.window = 1000;
+        return criteria;
+    }
+};
+
+enum class StopReason
+{
+    running,
+    solved,
+    iterations,
+    gradient,
+    stalled,
+    deadline,
+    cancelled
+};
+
+#endif // STOPCRITERIA_H
@@ -0,0 +1,84 @@
+#include "systemcache.h"
+#include "parser.h"
+
+
+SystemCache::SystemCache(std::size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+std::string SystemCache::key_of(std::string_view variables, std::string_view equations)
+{
+    std::string key;
+    std::string_view word;
+    while (Parser::next_word(variables, word)) {
+        key += word;
+        key += ' ';
+    }
+
+    while (!equations.empty()) {
+        std::size_t end = equations.find('\n');
+        std::string_view line = equations.substr(0, end);
+        equations.remove_prefix(end == std::string_view::npos ? equations.size() : end + 1);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        key += '\n';
+        while (Parser::next_word(line, word)) {
+            key += word;
+            key += ' ';
+        }
+    }
+
+    return key;
+}
+
+std::shared_ptr<const Tape> SystemCache::find(const std::string &key)
+{
+    std::lock_guard lk(mut_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        ++misses_;
+        return nullptr;
+    }
+
+    ++hits_;
+    entries_.splice(entries_.begin(), entries_, it->second);
+
+    return it->second->second;
+}
+
+void SystemCache::insert(const std::string &key, std::shared_ptr<const Tape> tape)
+{
+    std::lock_guard lk(mut_);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        it->second->second = std::move(tape);
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return;
+    }
+
+    entries_.emplace_front(key, std::move(tape));
+    index_[entries_.front().first] = entries_.begin();
+
+    if (entries_.size() > capacity_) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+}
+
+std::size_t SystemCache::hits() const
+{
+    std::lock_guard lk(mut_);
+    return hits_;
+}
+
+std::size_t SystemCache::misses() const
+{
+    std::lock_guard lk(mut_);
+    return misses_;
+}
+
+std::size_t SystemCache::size() const
+{
+    std::lock_guard lk(mut_);
+    return entries_.size();
+}
@@ -0,0 +1,43 @@
+#ifndef SYSTEMCACHE_H
+#define SYSTEMCACHE_H
+
+#include "tape.h"
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+// Least recently used compiled systems, keyed by the normalized text of the variables and the equations.
+// A Tape only reads its Parameters when a state is made, so one entry serves solves from any start.
+// Safe to share between threads.
+class SystemCache
+{
+    std::size_t capacity_;
+    std::list<std::pair<std::string, std::shared_ptr<const Tape>>> entries_{}; // most recently used first
+    std::unordered_map<std::string_view, decltype(entries_)::iterator> index_{}; // views into the keys of entries_
+    std::size_t hits_{0};
+    std::size_t misses_{0};
+    mutable std::mutex mut_{};
+public:
+    SystemCache(std::size_t capacity = 256);
+    SystemCache(const SystemCache&) = delete;
+    SystemCache& operator=(const SystemCache&) = delete;
+
+    // words separated by one space, comments and empty lines dropped
+    static std::string key_of(std::string_view variables, std::string_view equations);
+
+    // nullptr on a miss
+    std::shared_ptr<const Tape> find(const std::string &key);
+    void insert(const std::string &key, std::shared_ptr<const Tape> tape);
+
+    std::size_t hits() const;
+    std::size_t misses() const;
+    std::size_t size() const;
+};
+
+#endif // SYSTEMCACHE_H
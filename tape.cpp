@@ -0,0 +1,721 @@
+#include "tape.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+
+Tape::Tape(std::shared_ptr<Differentiable> root) : Tape(root, {}) {}
+
+Tape::Tape(std::shared_ptr<Differentiable> root, std::vector<std::shared_ptr<Parameter>> parameters)
+{
+    Profiler::Timer timer(ProfilePhase::compile);
+    root->get_all_parameters(parameters);
+    for (auto &x : parameters) {
+        add_parameter(x);
+    }
+
+    compile(root);
+}
+
+void Tape::add_parameter(const std::shared_ptr<Parameter>& parameter)
+{
+    if (index_.find(parameter.get()) != index_.end()) {
+        return;
+    }
+
+    index_[parameter.get()] = parameters_.size();
+    parameters_.push_back(parameter);
+    slot_of_parameter_.push_back(no_slot);
+}
+
+std::size_t Tape::compile(const std::shared_ptr<Differentiable>& node)
+{
+    auto it = compiled_.find(node.get());
+    if (it != compiled_.end()) {
+        return it->second;
+    }
+
+    std::size_t slot = node->compile(*this);
+    compiled_[node.get()] = slot;
+
+    return slot;
+}
+
+std::size_t Tape::push(OpCode op, std::size_t lhs, std::size_t rhs)
+{
+    ops_.push_back(op);
+    lhs_.push_back(lhs);
+    rhs_.push_back(rhs);
+    constants_.push_back(0);
+
+    return ops_.size() - 1;
+}
+
+std::size_t Tape::push_const(double value)
+{
+    std::size_t slot = push(OpCode::constant);
+    constants_[slot] = value;
+
+    return slot;
+}
+
+std::size_t Tape::push_var(const std::shared_ptr<Parameter>& parameter)
+{
+    add_parameter(parameter);
+    std::size_t i = index_[parameter.get()];
+    if (slot_of_parameter_[i] == no_slot) {
+        slot_of_parameter_[i] = push(OpCode::variable, i);
+    }
+
+    return slot_of_parameter_[i];
+}
+
+TapeState Tape::make_state() const
+{
+    TapeState state;
+    for (auto &x : parameters_) {
+        state.point.push_back(x->get_value());
+    }
+    prepare(state);
+
+    return state;
+}
+
+void Tape::prepare(TapeState& state) const
+{
+    if (state.point.size() != parameters_.size()) {
+        throw std::string{"invalid point"};
+    }
+
+    if (state.values.size() != ops_.size()) {
+        state.values = constants_;
+        state.derivatives.assign(ops_.size(), 0);
+    }
+}
+
+double Tape::operator()(TapeState& state) const
+{
+    prepare(state);
+    forward(state);
+
+    return state.values.back();
+}
+
+Grad<double> Tape::make_grad(TapeState& state, DiffMode mode) const
+{
+    Grad<double> gradient(std::vector<double>(parameters_.size(), 0));
+    make_grad(state, gradient, mode);
+
+    return gradient;
+}
+
+void Tape::make_grad(TapeState& state, GradView<double> gradient, DiffMode mode) const
+{
+    Profiler::add(ProfileCounter::gradient_calls);
+    Profiler::Timer timer(ProfilePhase::gradient);
+    prepare(state);
+    forward(state);
+
+    if (mode == DiffMode::reverse) {
+        backward(state, gradient);
+    } else if (parameters_.size() <= 4) {
+        tangent_vector<4>(state, gradient);
+    } else if (parameters_.size() <= 8) {
+        tangent_vector<8>(state, gradient);
+    } else {
+        tangent_vector<16>(state, gradient);
+    }
+}
+
+void Tape::evaluate_batch(TapeState& state, const std::vector<double>& points, std::size_t count, std::vector<double>& values, std::vector<double>& gradients) const
+{
+    const std::size_t n = parameters_.size();
+    if (points.size() < count * n) {
+        throw std::string{"not enough points"};
+    }
+
+    Profiler::add(ProfileCounter::gradient_calls, count);
+    Profiler::Timer timer(ProfilePhase::gradient);
+    values.resize(count);
+    gradients.assign(count * n, 0);
+    state.batch_values.resize(ops_.size() * batch_chunk);
+    state.batch_adjoints.resize(ops_.size() * batch_chunk);
+
+    for (std::size_t first = 0; first < count; first += batch_chunk) {
+        const std::size_t chunk = std::min(batch_chunk, count - first);
+
+        forward_batch(state, points.data() + first * n, chunk);
+        std::copy_n(state.batch_values.data() + (ops_.size() - 1) * batch_chunk, chunk, values.data() + first);
+        backward_batch(state, gradients.data() + first * n, chunk);
+    }
+}
+
+void Tape::hessian_vector(TapeState& state, const double *direction, GradView<double> gradient, GradView<double> product) const
+{
+    Profiler::add(ProfileCounter::gradient_calls);
+    Profiler::Timer timer(ProfilePhase::gradient);
+    prepare(state);
+    forward(state);
+    directional(state, direction);
+
+    const double *values = state.values.data();
+    const double *tangents = state.derivatives.data();
+    state.adjoints.assign(ops_.size(), 0);
+    state.adjoint_tangents.assign(ops_.size(), 0);
+    double *adjoints = state.adjoints.data();
+    double *dots = state.adjoint_tangents.data();
+
+    gradient *= 0;
+    product *= 0;
+    adjoints[ops_.size() - 1] = 1;
+
+    for (std::size_t i = ops_.size(); i-- > 0;) {
+        const double a = adjoints[i];
+        const double da = dots[i];
+        const std::size_t l = lhs_[i];
+        const std::size_t r = rhs_[i];
+
+        switch (ops_[i]) {
+        case OpCode::constant:
+            break;
+        case OpCode::variable:
+            gradient[l] += a;
+            product[l] += da;
+            break;
+        case OpCode::plus:
+            adjoints[l] += a;
+            adjoints[r] += a;
+            dots[l] += da;
+            dots[r] += da;
+            break;
+        case OpCode::sub:
+            adjoints[l] += a;
+            adjoints[r] -= a;
+            dots[l] += da;
+            dots[r] -= da;
+            break;
+        case OpCode::mul:
+            adjoints[l] += a * values[r];
+            adjoints[r] += a * values[l];
+            dots[l] += da * values[r] + a * tangents[r];
+            dots[r] += da * values[l] + a * tangents[l];
+            break;
+        case OpCode::dev: {
+            const double y = values[r];
+            const double x = values[l];
+            adjoints[l] += a / y;
+            adjoints[r] -= a * x / (y * y);
+            dots[l] += da / y - a * tangents[r] / (y * y);
+            dots[r] -= da * x / (y * y) + a * (tangents[l] / (y * y) - 2 * x * tangents[r] / (y * y * y));
+            break;
+        }
+        case OpCode::pow: {
+            const double x = values[l];
+            const double n = values[r];
+            const double first = n * pow(x, n - 1);
+            const double second = n == 1 ? 0 : n * (n - 1) * pow(x, n - 2);
+            adjoints[l] += a * first;
+            dots[l] += da * first + a * second * tangents[l];
+            break;
+        }
+        case OpCode::cos:
+            adjoints[l] -= a * std::sin(values[l]);
+            dots[l] -= da * std::sin(values[l]) + a * std::cos(values[l]) * tangents[l];
+            break;
+        case OpCode::sin:
+            adjoints[l] += a * std::cos(values[l]);
+            dots[l] += da * std::cos(values[l]) - a * std::sin(values[l]) * tangents[l];
+            break;
+        case OpCode::neg:
+            adjoints[l] -= a;
+            dots[l] -= da;
+            break;
+        }
+    }
+}
+
+namespace {
+
+// exact C literal of a double
+std::string literal(double x)
+{
+    if (std::isnan(x)) {
+        return "NAN";
+    }
+    if (std::isinf(x)) {
+        return x > 0 ? "HUGE_VAL" : "(-HUGE_VAL)";
+    }
+
+    char buf[40];
+    std::snprintf(buf, sizeof(buf), "%a", x);
+    return std::string{"("} + buf + ")";
+}
+
+} // namespace
+
+std::string Tape::make_source(const std::string &name) const
+{
+    const std::size_t n = ops_.size();
+    auto v = [] (std::size_t i) { return "v" + std::to_string(i); };
+    auto a = [] (std::size_t i) { return "a" + std::to_string(i); };
+
+    std::string s = "#include <math.h>\n\ndouble " + name + "(const double *point, double *gradient)\n{\n";
+    for (std::size_t i = 0; i < n; ++i) {
+        const std::string l = v(lhs_[i]);
+        const std::string r = v(rhs_[i]);
+        s += "    const double " + v(i) + " = ";
+
+        switch (ops_[i]) {
+        case OpCode::constant:
+            s += literal(constants_[i]);
+            break;
+        case OpCode::variable:
+            s += "point[" + std::to_string(lhs_[i]) + "]";
+            break;
+        case OpCode::plus:
+            s += l + " + " + r;
+            break;
+        case OpCode::sub:
+            s += l + " - " + r;
+            break;
+        case OpCode::mul:
+            s += l + " * " + r;
+            break;
+        case OpCode::dev:
+            s += l + " / " + r;
+            break;
+        case OpCode::pow:
+            s += "pow(" + l + ", " + r + ")";
+            break;
+        case OpCode::cos:
+            s += "cos(" + l + ")";
+            break;
+        case OpCode::sin:
+            s += "sin(" + l + ")";
+            break;
+        case OpCode::neg:
+            s += "-" + l;
+            break;
+        }
+        s += ";\n";
+    }
+
+    for (std::size_t i = 0; i + 1 < n; ++i) {
+        s += "    double " + a(i) + " = 0;\n";
+    }
+    s += "    const double " + a(n - 1) + " = 1;\n";
+    for (std::size_t j = 0; j < parameters_.size(); ++j) {
+        s += "    gradient[" + std::to_string(j) + "] = 0;\n";
+    }
+
+    // the rules of backward()
+    for (std::size_t i = n; i-- > 0;) {
+        const std::string l = std::to_string(lhs_[i]);
+        const std::string x = v(lhs_[i]);
+        const std::string y = v(rhs_[i]);
+        const std::string al = a(lhs_[i]);
+        const std::string ar = a(rhs_[i]);
+
+        switch (ops_[i]) {
+        case OpCode::constant:
+            break;
+        case OpCode::variable:
+            s += "    gradient[" + l + "] += " + a(i) + ";\n";
+            break;
+        case OpCode::plus:
+            s += "    " + al + " += " + a(i) + ";\n    " + ar + " += " + a(i) + ";\n";
+            break;
+        case OpCode::sub:
+            s += "    " + al + " += " + a(i) + ";\n    " + ar + " -= " + a(i) + ";\n";
+            break;
+        case OpCode::mul:
+            s += "    " + al + " += " + a(i) + " * " + y + ";\n    " + ar + " += " + a(i) + " * " + x + ";\n";
+            break;
+        case OpCode::dev:
+            s += "    " + al + " += " + a(i) + " / " + y + ";\n    " + ar + " -= " + a(i) + " * " + x + " / (" + y + " * " + y + ");\n";
+            break;
+        case OpCode::pow:
+            s += "    " + al + " += " + a(i) + " * " + y + " * pow(" + x + ", " + y + " - 1);\n";
+            break;
+        case OpCode::cos:
+            s += "    " + al + " -= " + a(i) + " * sin(" + x + ");\n";
+            break;
+        case OpCode::sin:
+            s += "    " + al + " += " + a(i) + " * cos(" + x + ");\n";
+            break;
+        case OpCode::neg:
+            s += "    " + al + " -= " + a(i) + ";\n";
+            break;
+        }
+    }
+
+    return s + "    return " + v(n - 1) + ";\n}\n";
+}
+
+std::size_t Tape::size() const
+{
+    return ops_.size();
+}
+
+const std::vector<std::shared_ptr<Parameter>>& Tape::get_parameters() const
+{
+    return parameters_;
+}
+
+void Tape::forward(TapeState& state) const
+{
+    double *values = state.values.data();
+    const std::size_t n = ops_.size();
+    Profiler::add(ProfileCounter::node_evaluations, n);
+    for (std::size_t i = 0; i < n; ++i) {
+        const std::size_t l = lhs_[i];
+        const std::size_t r = rhs_[i];
+
+        switch (ops_[i]) {
+        case OpCode::constant:
+            break;
+        case OpCode::variable:
+            values[i] = state.point[l];
+            break;
+        case OpCode::plus:
+            values[i] = values[l] + values[r];
+            break;
+        case OpCode::sub:
+            values[i] = values[l] - values[r];
+            break;
+        case OpCode::mul:
+            values[i] = values[l] * values[r];
+            break;
+        case OpCode::dev:
+            values[i] = values[l] / values[r];
+            break;
+        case OpCode::pow:
+            values[i] = pow(values[l], values[r]);
+            break;
+        case OpCode::cos:
+            values[i] = std::cos(values[l]);
+            break;
+        case OpCode::sin:
+            values[i] = std::sin(values[l]);
+            break;
+        case OpCode::neg:
+            values[i] = -values[l];
+            break;
+        }
+    }
+}
+
+void Tape::directional(TapeState& state, const double *seed) const
+{
+    tangent_sweep(state, [seed] (std::size_t l) { return seed[l]; });
+}
+
+template<typename Seed>
+void Tape::tangent_sweep(TapeState& state, Seed seed) const
+{
+    const double *values = state.values.data();
+    double *derivatives = state.derivatives.data();
+    const std::size_t n = ops_.size();
+    for (std::size_t i = 0; i < n; ++i) {
+        const std::size_t l = lhs_[i];
+        const std::size_t r = rhs_[i];
+
+        switch (ops_[i]) {
+        case OpCode::constant:
+            derivatives[i] = 0;
+            break;
+        case OpCode::variable:
+            derivatives[i] = seed(l);
+            break;
+        case OpCode::plus:
+            derivatives[i] = derivatives[l] + derivatives[r];
+            break;
+        case OpCode::sub:
+            derivatives[i] = derivatives[l] - derivatives[r];
+            break;
+        case OpCode::mul:
+            derivatives[i] = values[l] * derivatives[r] + derivatives[l] * values[r];
+            break;
+        case OpCode::dev:
+            derivatives[i] = (derivatives[l] * values[r] - values[l] * derivatives[r]) / (values[r] * values[r]);
+            break;
+        case OpCode::pow:
+            derivatives[i] = values[r] * pow(values[l], values[r] - 1) * derivatives[l];
+            break;
+        case OpCode::cos:
+            derivatives[i] = -std::sin(values[l]) * derivatives[l];
+            break;
+        case OpCode::sin:
+            derivatives[i] = std::cos(values[l]) * derivatives[l];
+            break;
+        case OpCode::neg:
+            derivatives[i] = -derivatives[l];
+            break;
+        }
+    }
+}
+
+template<std::size_t W>
+void Tape::tangent_vector(TapeState& state, GradView<double> gradient) const
+{
+    const std::size_t n = parameters_.size();
+    state.tangents.resize(ops_.size() * W);
+    const double *result = state.tangents.data() + (ops_.size() - 1) * W;
+
+    for (std::size_t first = 0; first < n; first += W) {
+        tangent_block<W>(state, first);
+        for (std::size_t w = 0; w < W && first + w < n; ++w) {
+            gradient[first + w] = result[w];
+        }
+    }
+}
+
+template<std::size_t W>
+void Tape::tangent_block(TapeState& state, std::size_t first) const
+{
+    const double *values = state.values.data();
+    double *tangents = state.tangents.data();
+    const std::size_t n = ops_.size();
+    for (std::size_t i = 0; i < n; ++i) {
+        const std::size_t l = lhs_[i];
+        const std::size_t r = rhs_[i];
+        double *t = tangents + i * W;
+        const double *x = tangents + l * W;
+        const double *y = tangents + r * W; // slot 0 for unary instructions, finite seeds there
+
+        // local partial derivatives once per instruction, the lanes are plain multiply-adds
+        double a = 0;
+        double b = 0;
+        switch (ops_[i]) {
+        case OpCode::constant:
+            for (std::size_t w = 0; w < W; ++w) {
+                t[w] = 0;
+            }
+            continue;
+        case OpCode::variable:
+            for (std::size_t w = 0; w < W; ++w) {
+                t[w] = l == first + w;
+            }
+            continue;
+        case OpCode::plus:
+            a = 1;
+            b = 1;
+            break;
+        case OpCode::sub:
+            a = 1;
+            b = -1;
+            break;
+        case OpCode::mul:
+            a = values[r];
+            b = values[l];
+            break;
+        case OpCode::dev:
+            a = 1 / values[r];
+            b = -values[l] / (values[r] * values[r]);
+            break;
+        case OpCode::pow:
+            a = values[r] * pow(values[l], values[r] - 1);
+            break;
+        case OpCode::cos:
+            a = -std::sin(values[l]);
+            break;
+        case OpCode::sin:
+            a = std::cos(values[l]);
+            break;
+        case OpCode::neg:
+            a = -1;
+            break;
+        }
+
+        for (std::size_t w = 0; w < W; ++w) {
+            t[w] = a * x[w] + b * y[w];
+        }
+    }
+}
+
+void Tape::backward(TapeState& state, GradView<double> gradient) const
+{
+    const double *values = state.values.data();
+    double *derivatives = state.derivatives.data();
+
+    gradient *= 0;
+    std::fill(state.derivatives.begin(), state.derivatives.end(), 0);
+    state.derivatives.back() = 1;
+
+    for (std::size_t i = ops_.size(); i-- > 0;) {
+        const double a = derivatives[i];
+        const std::size_t l = lhs_[i];
+        const std::size_t r = rhs_[i];
+
+        switch (ops_[i]) {
+        case OpCode::constant:
+            break;
+        case OpCode::variable:
+            gradient[l] += a;
+            break;
+        case OpCode::plus:
+            derivatives[l] += a;
+            derivatives[r] += a;
+            break;
+        case OpCode::sub:
+            derivatives[l] += a;
+            derivatives[r] -= a;
+            break;
+        case OpCode::mul:
+            derivatives[l] += a * values[r];
+            derivatives[r] += a * values[l];
+            break;
+        case OpCode::dev:
+            derivatives[l] += a / values[r];
+            derivatives[r] -= a * values[l] / (values[r] * values[r]);
+            break;
+        case OpCode::pow:
+            derivatives[l] += a * values[r] * pow(values[l], values[r] - 1);
+            break;
+        case OpCode::cos:
+            derivatives[l] -= a * std::sin(values[l]);
+            break;
+        case OpCode::sin:
+            derivatives[l] += a * std::cos(values[l]);
+            break;
+        case OpCode::neg:
+            derivatives[l] -= a;
+            break;
+        }
+    }
+}
+
+void Tape::forward_batch(TapeState& state, const double *points, std::size_t count) const
+{
+    const std::size_t n = ops_.size();
+    const std::size_t params = parameters_.size();
+    Profiler::add(ProfileCounter::node_evaluations, n * count);
+    for (std::size_t i = 0; i < n; ++i) {
+        double *out = state.batch_values.data() + i * batch_chunk;
+        const double *x = state.batch_values.data() + lhs_[i] * batch_chunk;
+        const double *y = state.batch_values.data() + rhs_[i] * batch_chunk;
+
+        switch (ops_[i]) {
+        case OpCode::constant:
+            std::fill_n(out, count, constants_[i]);
+            break;
+        case OpCode::variable:
+            for (std::size_t b = 0; b < count; ++b) {
+                out[b] = points[b * params + lhs_[i]];
+            }
+            break;
+        case OpCode::plus:
+            for (std::size_t b = 0; b < count; ++b) {
+                out[b] = x[b] + y[b];
+            }
+            break;
+        case OpCode::sub:
+            for (std::size_t b = 0; b < count; ++b) {
+                out[b] = x[b] - y[b];
+            }
+            break;
+        case OpCode::mul:
+            for (std::size_t b = 0; b < count; ++b) {
+                out[b] = x[b] * y[b];
+            }
+            break;
+        case OpCode::dev:
+            for (std::size_t b = 0; b < count; ++b) {
+                out[b] = x[b] / y[b];
+            }
+            break;
+        case OpCode::pow:
+            for (std::size_t b = 0; b < count; ++b) {
+                out[b] = pow(x[b], y[b]);
+            }
+            break;
+        case OpCode::cos:
+            for (std::size_t b = 0; b < count; ++b) {
+                out[b] = std::cos(x[b]);
+            }
+            break;
+        case OpCode::sin:
+            for (std::size_t b = 0; b < count; ++b) {
+                out[b] = std::sin(x[b]);
+            }
+            break;
+        case OpCode::neg:
+            for (std::size_t b = 0; b < count; ++b) {
+                out[b] = -x[b];
+            }
+            break;
+        }
+    }
+}
+
+void Tape::backward_batch(TapeState& state, double *gradients, std::size_t count) const
+{
+    const std::size_t params = parameters_.size();
+    std::fill(state.batch_adjoints.begin(), state.batch_adjoints.end(), 0);
+    std::fill_n(state.batch_adjoints.data() + (ops_.size() - 1) * batch_chunk, count, 1.0);
+
+    for (std::size_t i = ops_.size(); i-- > 0;) {
+        const double *a = state.batch_adjoints.data() + i * batch_chunk;
+        double *dx = state.batch_adjoints.data() + lhs_[i] * batch_chunk;
+        double *dy = state.batch_adjoints.data() + rhs_[i] * batch_chunk;
+        const double *x = state.batch_values.data() + lhs_[i] * batch_chunk;
+        const double *y = state.batch_values.data() + rhs_[i] * batch_chunk;
+
+        switch (ops_[i]) {
+        case OpCode::constant:
+            break;
+        case OpCode::variable:
+            for (std::size_t b = 0; b < count; ++b) {
+                gradients[b * params + lhs_[i]] += a[b];
+            }
+            break;
+        case OpCode::plus:
+            for (std::size_t b = 0; b < count; ++b) {
+                dx[b] += a[b];
+                dy[b] += a[b];
+            }
+            break;
+        case OpCode::sub:
+            for (std::size_t b = 0; b < count; ++b) {
+                dx[b] += a[b];
+                dy[b] -= a[b];
+            }
+            break;
+        case OpCode::mul:
+            for (std::size_t b = 0; b < count; ++b) {
+                dx[b] += a[b] * y[b];
+                dy[b] += a[b] * x[b];
+            }
+            break;
+        case OpCode::dev:
+            for (std::size_t b = 0; b < count; ++b) {
+                dx[b] += a[b] / y[b];
+                dy[b] -= a[b] * x[b] / (y[b] * y[b]);
+            }
+            break;
+        case OpCode::pow:
+            for (std::size_t b = 0; b < count; ++b) {
+                dx[b] += a[b] * y[b] * pow(x[b], y[b] - 1);
+            }
+            break;
+        case OpCode::cos:
+            for (std::size_t b = 0; b < count; ++b) {
+                dx[b] -= a[b] * std::sin(x[b]);
+            }
+            break;
+        case OpCode::sin:
+            for (std::size_t b = 0; b < count; ++b) {
+                dx[b] += a[b] * std::cos(x[b]);
+            }
+            break;
+        case OpCode::neg:
+            for (std::size_t b = 0; b < count; ++b) {
+                dx[b] -= a[b];
+            }
+            break;
+        }
+    }
+}
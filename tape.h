@@ -0,0 +1,121 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include "differentiable.h"
+#include "parameter.h"
+#include "grad.h"
+
+#include <memory>
+#include <vector>
+#include <map>
+#include <string>
+
+
+// Every evaluator of tape.cpp switches over all instructions without a default, CMake turns a missing case
+// into an error: forward, tangent_sweep, tangent_block, backward, forward_batch, backward_batch,
+// hessian_vector and the two switches of make_source
+enum class OpCode : unsigned char
+{
+    constant,
+    variable,
+    plus,
+    sub,
+    mul,
+    dev,
+    pow,
+    cos,
+    sin,
+    neg
+};
+
+// Everything an evaluation writes: the point and the buffers of the sweeps.
+// A Tape is not modified after compilation, so each solve keeps its own state and
+// any number of solves can share one Tape without locks.
+struct TapeState
+{
+    std::vector<double> point{};            // one value per parameter of the tape
+    std::vector<double> values{};
+    std::vector<double> derivatives{};      // tangents of directional(), adjoints in reverse mode
+    std::vector<double> tangents{};         // forward mode: a block of W parameters per sweep, lane w of slot i at i * W + w
+    std::vector<double> adjoints{};         // hessian_vector(): adjoints and their tangents along the direction
+    std::vector<double> adjoint_tangents{};
+    std::vector<double> batch_values{};     // slot-major: Tape::batch_chunk values of slot i start at i * batch_chunk
+    std::vector<double> batch_adjoints{};
+
+    double get_value() const
+    {
+        return values.back();
+    }
+};
+
+// Differentiable compiled into a flat array of instructions in topological order.
+// Slot i holds the result of instruction i, the last slot is the result of the whole expression.
+class Tape
+{
+    static constexpr std::size_t no_slot = static_cast<std::size_t>(-1);
+
+    std::vector<OpCode> ops_{};
+    std::vector<std::size_t> lhs_{}; // first argument slot, parameter index for OpCode::variable
+    std::vector<std::size_t> rhs_{}; // second argument slot
+    std::vector<double> constants_{}; // values of OpCode::constant slots, 0 elsewhere
+
+    std::vector<std::shared_ptr<Parameter>> parameters_{};
+    std::map<Parameter*, std::size_t> index_{};
+    std::vector<std::size_t> slot_of_parameter_{};
+    std::map<Differentiable*, std::size_t> compiled_{}; // shared subexpressions get a single slot
+public:
+    static constexpr std::size_t batch_chunk = 64;
+
+    Tape(std::shared_ptr<Differentiable> root);
+    // the gradient follows the order of parameters, parameters of root missing there are appended
+    Tape(std::shared_ptr<Differentiable> root, std::vector<std::shared_ptr<Parameter>> parameters);
+
+    std::size_t compile(const std::shared_ptr<Differentiable>& node);
+    std::size_t push(OpCode op, std::size_t lhs = 0, std::size_t rhs = 0);
+    std::size_t push_const(double value);
+    std::size_t push_var(const std::shared_ptr<Parameter>& parameter);
+
+    // state at the current values of the parameters, the only place the Parameters are read
+    TapeState make_state() const;
+
+    // evaluate at state.point
+    double operator()(TapeState& state) const;
+    Grad<double> make_grad(TapeState& state, DiffMode mode = DiffMode::reverse) const;
+    // writes the gradient into a buffer of get_parameters().size() elements, does not allocate
+    void make_grad(TapeState& state, GradView<double> gradient, DiffMode mode = DiffMode::reverse) const;
+
+    // points is row-major count x get_parameters().size(), values receives count results and
+    // gradients count x get_parameters().size() derivatives, one pass over the tape per chunk of points
+    void evaluate_batch(TapeState& state, const std::vector<double>& points, std::size_t count, std::vector<double>& values, std::vector<double>& gradients) const;
+
+    // forward mode along a direction: state.derivatives[slot] becomes the derivative of the slot
+    // along seed, which has get_parameters().size() elements, expects the values of the last sweep
+    void directional(TapeState& state, const double *seed) const;
+
+    // forward-over-reverse: the gradient and the product of the Hessian with direction at state.point,
+    // the Hessian is never formed. pow differentiates only by its base, like the other sweeps
+    void hessian_vector(TapeState& state, const double *direction, GradView<double> gradient, GradView<double> product) const;
+
+    // C source of double name(const double *point, double *gradient): value and reverse mode gradient
+    // as straight-line code, one local per slot, see NativeTape
+    std::string make_source(const std::string &name) const;
+
+    std::size_t size() const;
+    const std::vector<std::shared_ptr<Parameter>>& get_parameters() const;
+private:
+    void add_parameter(const std::shared_ptr<Parameter>& parameter);
+    void prepare(TapeState& state) const;
+    void forward(TapeState& state) const;
+    template<typename Seed>
+    void tangent_sweep(TapeState& state, Seed seed) const;
+    // forward mode gradient, W parameters are seeded per sweep
+    template<std::size_t W>
+    void tangent_vector(TapeState& state, GradView<double> gradient) const;
+    template<std::size_t W>
+    void tangent_block(TapeState& state, std::size_t first) const;
+    void backward(TapeState& state, GradView<double> gradient) const;
+    void forward_batch(TapeState& state, const double *points, std::size_t count) const;
+    void backward_batch(TapeState& state, double *gradients, std::size_t count) const;
+};
+
+#endif // TAPE_H
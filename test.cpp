@@ -1,10 +1,30 @@
 #include "differentiable.h"
-//#include "optimizer.h"
+#include "tape.h"
+#include "nodefactory.h"
+#include "optimizer.h"
+#include "multistart.h"
+#include "batchsolver.h"
+#include "parser.h"
+#include "systemcache.h"
+#include "residuals.h"
+#include "levenbergmarquardt.h"
+#include "newtonsolver.h"
+#include "staticexpr.h"
+#include "nativetape.h"
+#include "profiler.h"
+#include "model.h"
 
 #include <gtest/gtest.h>
 #include <memory>
 #include <iostream>
+#include <sstream>
 #include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
+#include <limits>
+#include <random>
+#include <thread>
 #include <vector>
 
 
@@ -198,6 +218,279 @@ TEST(Diff, MakeGrad)
     ASSERT_DOUBLE_EQ(g[1], 6);
 }
 
+TEST(Diff, MakeGradReverse)
+{
+    std::shared_ptr<Parameter> p = std::make_shared<Parameter>(0.7, false, "x");
+    std::shared_ptr<Differentiable> dx = std::make_shared<Var>(p);
+
+    std::shared_ptr<Parameter> pr = std::make_shared<Parameter>(-1.3, false, "y");
+    std::shared_ptr<Differentiable> dy = std::make_shared<Var>(pr);
+
+    auto f = d_sin(dx * dy) / (d_cos(dy) + CONST(2)) - d_pow(dx, CONST(3)) + (-dy) * dx;
+
+    Grad<double> forward = f->make_grad(DiffMode::forward);
+    Grad<double> reverse = f->make_grad(DiffMode::reverse);
+
+    ASSERT_DOUBLE_EQ(reverse[0], forward[0]);
+    ASSERT_DOUBLE_EQ(reverse[1], forward[1]);
+}
+
+TEST(Diff, Tape)
+{
+    std::shared_ptr<Parameter> p = std::make_shared<Parameter>(0.7, false, "x");
+    std::shared_ptr<Differentiable> dx = std::make_shared<Var>(p);
+
+    std::shared_ptr<Parameter> pr = std::make_shared<Parameter>(-1.3, false, "y");
+    std::shared_ptr<Differentiable> dy = std::make_shared<Var>(pr);
+
+    auto f = d_sin(dx * dy) / (d_cos(dy) + CONST(2)) - d_pow(dx, CONST(3)) + (-dy) * dx;
+    Tape tape(f);
+
+    for (double x = -2; x < 2; x += 0.5) {
+        p->set_value(x);
+
+        // the state is the only thing the tape reads and writes
+        TapeState state = tape.make_state();
+        p->set_value(100);
+
+        Grad<double> forward = tape.make_grad(state, DiffMode::forward);
+        Grad<double> reverse = tape.make_grad(state, DiffMode::reverse);
+
+        p->set_value(x);
+        Grad<double> expected = f->make_grad(DiffMode::reverse);
+
+        ASSERT_DOUBLE_EQ(state.get_value(), f->get_value());
+        ASSERT_NEAR(forward[0], expected[0], 1e-12);
+        ASSERT_NEAR(forward[1], expected[1], 1e-12);
+        ASSERT_NEAR(reverse[0], expected[0], 1e-12);
+        ASSERT_NEAR(reverse[1], expected[1], 1e-12);
+    }
+}
+
+TEST(Diff, VectorForward)
+{
+    // 3, 7 and 20 parameters: one partial block of each width
+    for (int n : {3, 7, 20}) {
+        std::vector<std::shared_ptr<Parameter>> params;
+        std::shared_ptr<Differentiable> f = CONST(1);
+        for (int i = 0; i < n; ++i) {
+            params.push_back(std::make_shared<Parameter>(0.3 + 0.1 * i, true, "x" + std::to_string(i)));
+            auto x = std::make_shared<Var>(params.back());
+            f = f * d_sin(x) + x / (x * x + CONST(1)) - d_pow(d_cos(x) + CONST(2), CONST(2.5));
+        }
+
+        Tape tape(f);
+        TapeState state = tape.make_state();
+        Grad<double> forward = tape.make_grad(state, DiffMode::forward);
+        Grad<double> reverse = tape.make_grad(state, DiffMode::reverse);
+
+        ASSERT_EQ(forward.size(), n);
+        for (int i = 0; i < n; ++i) {
+            ASSERT_NEAR(forward[i], reverse[i], 1e-12);
+        }
+    }
+}
+
+TEST(Diff, StaticExpression)
+{
+    constexpr auto x = static_var<0>;
+    constexpr auto y = static_var<1>;
+    constexpr double at[] = {2, 3};
+    static_assert((x * y + 2 * x - y / 3.0)(at) == 9, "polynomials evaluate at compile time");
+
+    // the same function as nodes
+    std::vector<std::shared_ptr<Parameter>> params{std::make_shared<Parameter>(0.7, true, "x"), std::make_shared<Parameter>(-0.4, true, "y")};
+    auto vx = std::make_shared<Var>(params[0]);
+    auto vy = std::make_shared<Var>(params[1]);
+    auto f = d_sin(x * y) / (x * x + 1.0) - d_pow(d_cos(y) + 2.0, 2.5) + -x;
+    auto g = d_sin(vx * vy) / (vx * vx + CONST(1)) - d_pow(d_cos(vy) + CONST(2), CONST(2.5)) + -vx;
+    static_assert(decltype(f)::size == 2);
+
+    Tape tape(g, params);
+    TapeState state = tape.make_state();
+    Grad<double> expected = tape.make_grad(state);
+
+    Grad<double> gradient(std::vector<double>(2, 0));
+    ASSERT_NEAR(f.make_grad(state.point.data(), gradient), state.get_value(), 1e-15);
+    ASSERT_NEAR(f(state.point.data()), state.get_value(), 1e-15);
+    for (std::size_t i = 0; i < 2; ++i) {
+        ASSERT_NEAR(gradient[i], expected[i], 1e-14);
+        ASSERT_NEAR(f.make_grad(state.point)[i], expected[i], 1e-14);
+    }
+    ASSERT_THROW(f.make_grad(std::vector<double>{1}), std::string);
+    ASSERT_THROW(f.make_grad(state.point.data(), GradView<double>(gradient.view().data(), 1)), std::string);
+    ASSERT_THROW(f.to_differentiable({params[0]}), std::string);
+
+    // through the nodes to the optimizers: x^2 + y^2 - 4 and x - y
+    auto circle = d_pow(x * x + y * y - 4.0, 2.0) + d_pow(x - y, 2.0);
+    params[0]->set_value(1);
+    params[1]->set_value(1);
+    Optimizer optimizer(circle.to_differentiable(params), 0.01);
+    optimizer();
+    ASSERT_LT(optimizer.get_loss(), 1e-10);
+    ASSERT_NEAR(optimizer.get_solution()[0], std::sqrt(2), 1e-5);
+}
+
+TEST(Diff, NativeTape)
+{
+    if (std::system((NativeTape::default_compiler() + " --version > /dev/null 2>&1").c_str()) != 0) {
+        GTEST_SKIP() << "no C compiler";
+    }
+    // own directory per run, with a quote in its name that a shell would choke on
+    const std::filesystem::path directory = std::filesystem::temp_directory_path()
+        / ("autodiff_jit_test 'run " + std::to_string(std::random_device{}()) + "'");
+    std::filesystem::remove_all(directory);
+
+    Parser parser;
+    parser.add_variables("x y z");
+    auto &variables = parser.get_variables();
+    variables[0]->set_value(0.7);
+    variables[1]->set_value(-1.3);
+    variables[2]->set_value(2.1);
+    auto tape = std::make_shared<const Tape>(parser.make_equation("x * y - sin z / y\ncos ( x * z ) + y ^ 3 - z + x ^ 2.5 - 0.1"), variables);
+
+    NativeTape native(*tape, directory.string());
+    ASSERT_FALSE(native.from_cache());
+    ASSERT_EQ(native.size(), 3);
+
+    TapeState state = tape->make_state();
+    Grad<double> expected = tape->make_grad(state);
+    Grad<double> gradient(std::vector<double>(3, 0));
+    ASSERT_DOUBLE_EQ(native.make_grad(state.point, gradient), state.get_value());
+    for (std::size_t i = 0; i < 3; ++i) {
+        ASSERT_DOUBLE_EQ(gradient[i], expected[i]);
+    }
+
+    // the same system again, loaded without compiling
+    NativeTape again(*tape, directory.string());
+    ASSERT_TRUE(again.from_cache());
+
+    // drop-in for the tape inside Optimizer
+    Parser circle;
+    circle.add_variables("x y");
+    circle.get_variables()[0]->set_value(1);
+    circle.get_variables()[1]->set_value(2);
+    auto circle_tape = std::make_shared<const Tape>(circle.make_equation("x * x + y * y - 4\nx - y"), circle.get_variables());
+    Optimizer interpreted(circle_tape, {}, 0.01);
+    interpreted();
+    Optimizer compiled(circle_tape, {}, 0.01);
+    compiled.set_native(std::make_shared<const NativeTape>(*circle_tape, directory.string()));
+    compiled();
+    ASSERT_NEAR(compiled.get_loss(), interpreted.get_loss(), 1e-12);
+    ASSERT_NEAR(compiled.get_solution()[0], interpreted.get_solution()[0], 1e-9);
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST(Diff, NodeFactory)
+{
+    std::shared_ptr<Parameter> p = std::make_shared<Parameter>(0.5, false, "x");
+    NodeFactory factory;
+
+    auto s1 = factory.make<Sin>(factory.variable(p));
+    auto s2 = factory.make<Sin>(factory.variable(p));
+    auto f = factory.make<Mul>(s1, s2);
+
+    ASSERT_EQ(s1, s2);
+    ASSERT_EQ(factory.make<Mul>(factory.constant(2), s1), factory.make<Mul>(s1, factory.constant(2)));
+
+    Tape tape(f);
+    TapeState state = tape.make_state();
+    Grad<double> g = tape.make_grad(state);
+
+    ASSERT_EQ(tape.size(), 3);
+    ASSERT_DOUBLE_EQ(state.get_value(), std::sin(0.5) * std::sin(0.5));
+    ASSERT_DOUBLE_EQ(g[0], 2 * std::sin(0.5) * std::cos(0.5));
+}
+
+TEST(Diff, Simplify)
+{
+    std::shared_ptr<Parameter> p = std::make_shared<Parameter>(1.5, false, "x");
+    std::shared_ptr<Differentiable> x = std::make_shared<Var>(p);
+    NodeFactory factory;
+    auto fx = factory.variable(p);
+
+    ASSERT_EQ(factory.rebuild(x * CONST(1) + CONST(0)), fx);
+    ASSERT_EQ(factory.rebuild(d_pow(x, CONST(1)) / CONST(1) - CONST(0)), fx);
+    ASSERT_EQ(factory.rebuild(d_pow(x, CONST(2))), factory.make<Mul>(fx, fx));
+
+    auto folded = factory.rebuild(d_pow(CONST(10), CONST(2)) + d_sin(CONST(0)) * CONST(3));
+    ASSERT_TRUE(std::dynamic_pointer_cast<Const>(folded));
+    ASSERT_DOUBLE_EQ((*folded)(), 100);
+
+    // x ^ 5 = x * (x * x) * (x * x): two squarings and one more multiplication
+    auto f = d_pow(x, CONST(5)) - d_pow(x, CONST(-2)) + d_pow(x, CONST(0.5)) + CONST(0) - x;
+    auto g = factory.rebuild(f);
+    Tape tape(g);
+    TapeState state = tape.make_state();
+    Grad<double> gradient = tape.make_grad(state);
+
+    ASSERT_DOUBLE_EQ(state.get_value(), (*f)());
+    ASSERT_NEAR(gradient[0], 5 * std::pow(1.5, 4) + 2 * std::pow(1.5, -3) + 0.5 / std::sqrt(1.5) - 1, 1e-12);
+    ASSERT_EQ(factory.rebuild(f), g);
+}
+
+TEST(Diff, NodeArena)
+{
+    std::shared_ptr<Differentiable> f;
+    {
+        std::shared_ptr<Parameter> p = std::make_shared<Parameter>(2, false, "x");
+        NodeFactory factory;
+        f = factory.make<Pow>(factory.variable(p), factory.constant(3));
+        for (int i = 0; i < 10000; ++i) {
+            f = factory.make<Plus>(f, factory.constant(i));
+        }
+
+        ASSERT_EQ(factory.size(), 20002);
+        ASSERT_GE(factory.allocated(), 20002 * sizeof(Const));
+    }
+
+    // nodes outlive the factory, the arena is released with the last of them
+    ASSERT_DOUBLE_EQ((*f)(), 8 + 9999.0 * 10000 / 2);
+    f.reset();
+
+    NodeArena arena;
+    for (std::size_t alignment : {1, 8, 16, 64}) {
+        void *p = arena.allocate(3, alignment);
+        ASSERT_EQ(reinterpret_cast<std::uintptr_t>(p) % alignment, 0);
+    }
+    ASSERT_NE(arena.allocate(1 << 20, 8), nullptr);
+}
+
+TEST(Diff, TapeBatch)
+{
+    std::shared_ptr<Parameter> p = std::make_shared<Parameter>(0, false, "x");
+    std::shared_ptr<Differentiable> dx = std::make_shared<Var>(p);
+
+    std::shared_ptr<Parameter> pr = std::make_shared<Parameter>(0, false, "y");
+    std::shared_ptr<Differentiable> dy = std::make_shared<Var>(pr);
+
+    auto f = d_sin(dx * dy) / (d_cos(dy) + CONST(2)) - d_pow(dx, CONST(3)) + (-dy) * dx;
+    Tape tape(f);
+
+    constexpr std::size_t count = 150;
+    std::vector<double> points;
+    for (std::size_t i = 0; i < count; ++i) {
+        points.push_back(std::sin(i * 0.1));
+        points.push_back(std::cos(i * 0.7));
+    }
+
+    std::vector<double> values, gradients;
+    TapeState state;
+    tape.evaluate_batch(state, points, count, values, gradients);
+
+    ASSERT_EQ(values.size(), count);
+    ASSERT_EQ(gradients.size(), count * 2);
+    for (std::size_t i = 0; i < count; ++i) {
+        state.point = {points[2 * i], points[2 * i + 1]};
+        Grad<double> g = tape.make_grad(state);
+
+        ASSERT_DOUBLE_EQ(values[i], state.get_value());
+        ASSERT_NEAR(gradients[2 * i], g[0], 1e-12);
+        ASSERT_NEAR(gradients[2 * i + 1], g[1], 1e-12);
+    }
+}
+
 TEST(Diff, Gradient)
 {
     double tx = 2;
@@ -223,16 +516,588 @@ TEST(Diff, Gradient)
     ASSERT_DOUBLE_EQ(t[1], 123);
 }
 
-TEST(Diff, Equation)
+TEST(Diff, GradInPlace)
 {
-    std::shared_ptr<Parameter> p = std::make_shared<Parameter>(1, false, "x");
-    std::shared_ptr<Differentiable> x = std::make_shared<Var>(p);
+    Grad<double> a(std::vector<double>{1, 2, 3});
+    Grad<double> b(std::vector<double>{4, 5, 6});
+
+    a += b;
+    a *= 2;
+    a.axpy(-1, b);
+    ASSERT_DOUBLE_EQ(a[0], 6);
+    ASSERT_DOUBLE_EQ(a[2], 12);
+
+    a.axpby(0.5, b, 2);
+    ASSERT_DOUBLE_EQ(a[1], 20.5);
+    ASSERT_DOUBLE_EQ(a * b, 14 * 4 + 20.5 * 5 + 27 * 6);
+
+    double buffer[3] = {1, 1, 1};
+    GradView<double> view(buffer, 3);
+    view -= b;
+    view /= -1;
+    ASSERT_DOUBLE_EQ(buffer[0], 3);
+    ASSERT_DOUBLE_EQ(buffer[2], 5);
+
+    Grad<double> moved(std::move(b));
+    ASSERT_EQ(moved.size(), 3);
+    ASSERT_DOUBLE_EQ((moved - Grad<double>(std::vector<double>{4, 5, 6})) * moved, 0);
+}
+
+TEST(Diff, GradKernels)
+{
+    constexpr std::size_t n = 37;
+    std::vector<double> x(n), y(n), m(n, 0.1), v(n, 0.2), step(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        x[i] = std::sin(i + 1.0);
+        y[i] = std::cos(i * 0.3);
+    }
+
+    // the ISA selected on entry comes back however the test ends, the later tests run on it
+    struct RestoreIsa
+    {
+        KernelIsa isa{kernel_isa()};
+        ~RestoreIsa()
+        {
+            set_kernel_isa(isa);
+        }
+    } restore;
+
+    ASSERT_TRUE(set_kernel_isa(KernelIsa::scalar));
+    double dot = dot_kernel(x.data(), y.data(), n);
+    std::vector<double> axpby = y;
+    axpby_kernel(axpby.data(), 0.3, x.data(), -2, n);
+    std::vector<double> adam_m = m, adam_v = v, adam_step = step;
+    adam_kernel(adam_step.data(), adam_m.data(), adam_v.data(), x.data(), n, 0.9, 0.999, 1e-2, 10, 1e-8);
+
+    for (KernelIsa isa : {KernelIsa::avx2, KernelIsa::avx512}) {
+        if (!set_kernel_isa(isa)) {
+            continue;
+        }
+
+        ASSERT_NEAR(dot_kernel(x.data(), y.data(), n), dot, 1e-12);
+
+        std::vector<double> z = y;
+        axpby_kernel(z.data(), 0.3, x.data(), -2, n);
+        std::vector<double> mm = m, vv = v, ss = step;
+        adam_kernel(ss.data(), mm.data(), vv.data(), x.data(), n, 0.9, 0.999, 1e-2, 10, 1e-8);
+        for (std::size_t i = 0; i < n; ++i) {
+            ASSERT_NEAR(z[i], axpby[i], 1e-12);
+            ASSERT_NEAR(mm[i], adam_m[i], 1e-12);
+            ASSERT_NEAR(vv[i], adam_v[i], 1e-12);
+            ASSERT_NEAR(ss[i], adam_step[i], 1e-12);
+        }
+    }
+}
+
+TEST(Diff, MultiStart)
+{
+    std::shared_ptr<Parameter> p = std::make_shared<Parameter>(0, true, "x");
+    std::shared_ptr<Differentiable> dx = std::make_shared<Var>(p);
+
+    std::shared_ptr<Parameter> pr = std::make_shared<Parameter>(0, true, "y");
+    std::shared_ptr<Differentiable> dy = std::make_shared<Var>(pr);
+
+    // (0, 0) is a stationary point, only the shifted starts can leave it
+    auto circle = dx * dx + dy * dy - CONST(100);
+    auto line = dx - dy;
+    auto f = circle * circle + line * line;
+
+    auto pool = std::make_shared<ThreadPool>(4);
+    auto tape = std::make_shared<const Tape>(f);
+    MultiStartSolver::Result r = MultiStartSolver(pool, 8)(tape);
+
+    ASSERT_TRUE(r.solved);
+    ASSERT_NEAR(std::abs(r.solution[0]), std::sqrt(50), 1e-6);
+    ASSERT_NEAR(r.solution[0], r.solution[1], 1e-6);
+    ASSERT_EQ(p->get_value(), 0);
+
+    Optimizer opti(tape, r.solution);
+    opti();
+    opti.write_parameters();
+    ASSERT_DOUBLE_EQ(p->get_value(), r.solution[0]);
+
+    // the run from the origin diverges to a non-finite loss, the next start still wins
+    Parser parser;
+    parser.add_variables("x");
+    auto well = std::make_shared<const Tape>(parser.make_equation("x * x - 4"), parser.get_variables());
+    MultiStartSolver::Result best = MultiStartSolver(nullptr, 3)({0.5}, [well] (std::vector<double> start, const std::atomic<bool> *stop) {
+        const bool origin = start[0] == 0.5;
+        Optimizer optimizer(well, std::move(start), origin ? 1e3 : 0.1);
+        optimizer.set_method(origin ? OptimizerMethod::nesterov : OptimizerMethod::adam);
+        StopCriteria criteria;
+        criteria.max_iterations = origin ? 100 : 50000;
+        optimizer.set_stop_criteria(criteria);
+        optimizer.set_stop_flag(stop);
+        optimizer();
+        if (origin) {
+            EXPECT_FALSE(std::isfinite(optimizer.get_loss()));
+        }
+
+        return MultiStartSolver::Result{optimizer.get_solution(), optimizer.get_loss(), optimizer.is_solved()};
+    });
+    ASSERT_TRUE(best.solved);
+    ASSERT_NEAR(std::abs(best.solution[0]), 2, 1e-9);
+}
+
+TEST(Diff, StopCriteria)
+{
+    Parser parser;
+    parser.add_variables("x");
+    auto hopeless = std::make_shared<const Tape>(parser.make_equation("sin x + 2"), parser.get_variables());
+    auto easy = std::make_shared<const Tape>(parser.make_equation("x - 3"), parser.get_variables());
+
+    Optimizer solved(easy, {0}, 0.1);
+    solved();
+    ASSERT_EQ(solved.get_stop_reason(), StopReason::solved);
+
+    // gives up long before the iteration budget
+    Optimizer stalled(hopeless, {0}, 0.01);
+    stalled.set_stop_criteria(StopCriteria::with_stall_detection());
+    stalled();
+    ASSERT_FALSE(stalled.is_solved());
+    ASSERT_TRUE(stalled.get_stop_reason() == StopReason::stalled || stalled.get_stop_reason() == StopReason::gradient);
+
+    StopCriteria endless;
+    endless.window = 0;
+    endless.max_iterations = std::numeric_limits<int>::max();
+    endless.deadline = std::chrono::milliseconds(20);
+    Optimizer late(hopeless, {0}, 0.01);
+    late.set_stop_criteria(endless);
+    late();
+    ASSERT_EQ(late.get_stop_reason(), StopReason::deadline);
+
+    std::atomic<bool> stop{true};
+    Optimizer cancelled(hopeless, {0});
+    cancelled.set_stop_flag(&stop);
+    cancelled();
+    ASSERT_EQ(cancelled.get_stop_reason(), StopReason::cancelled);
+
+    // Model aborts a solve that would run for ever
+    std::promise<std::string> answer;
+    Model model([&answer] (std::string a) { answer.set_value(a); });
+    model.add_variables("x");
+    endless.deadline = std::chrono::nanoseconds(0);
+    model.set_stop_criteria(endless);
+    model.solve("sin x + 2");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    model.cancel();
+
+    auto result = answer.get_future();
+    ASSERT_EQ(result.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+    ASSERT_EQ(result.get(), "no decision");
+}
+
+// counts the evaluations of the rule it wraps
+class CountingStrategy : public OptimizerStrategy, private Objective
+{
+    std::unique_ptr<OptimizerStrategy> rule_;
+    Objective *objective_{nullptr};
+public:
+    int evaluations{0};
+
+    CountingStrategy(std::unique_ptr<OptimizerStrategy> rule) : rule_(std::move(rule)) {}
+
+    bool step(Objective &objective, std::vector<double> &point, double &loss, Grad<double> &gradient) override
+    {
+        objective_ = &objective;
+        return rule_->step(*this, point, loss, gradient);
+    }
+private:
+    double evaluate(const std::vector<double> &point, GradView<double> gradient) override
+    {
+        ++evaluations;
+        return objective_->evaluate(point, gradient);
+    }
+};
+
+TEST(Diff, OptimizerStrategies)
+{
+    Parser parser;
+    parser.add_variables("x y");
+    auto tape = std::make_shared<const Tape>(parser.make_equation("x * x + y * y - 100\nx - y"), parser.get_variables());
+    StopCriteria criteria;
+    criteria.loss = 1e-20;
+
+    auto run = [&] (OptimizerMethod method, double lr) {
+        Optimizer optimizer(tape, {1, 1}, lr);
+        auto counting = std::make_unique<CountingStrategy>(make_strategy(method, 2, lr, 0.9, 0.999));
+        int &evaluations = counting->evaluations;
+        optimizer.set_strategy(std::move(counting));
+        optimizer.set_stop_criteria(criteria);
+        optimizer();
+        EXPECT_TRUE(optimizer.is_solved()) << static_cast<int>(method);
+        EXPECT_NEAR(optimizer.get_solution()[0], std::sqrt(50), 1e-6);
+        return evaluations;
+    };
+
+    int adam = run(OptimizerMethod::adam, 0.1);
+    int lbfgs = run(OptimizerMethod::lbfgs, 0.1);
+    int nesterov = run(OptimizerMethod::nesterov, 1e-3);
+    run(OptimizerMethod::rmsprop, 1e-3);
+    int descent = run(OptimizerMethod::gradient_descent, 0.1);
+    ASSERT_LT(lbfgs, adam);
+    ASSERT_LT(lbfgs, nesterov);
+    ASSERT_LT(lbfgs, descent);
+
+    // Rosenbrock from its usual start, a narrow curved valley
+    auto valley = std::make_shared<const Tape>(parser.make_equation("1 - x\n10 * ( y - x * x )"), parser.get_variables());
+    Optimizer optimizer(valley, {-1.2, 1});
+    optimizer.set_method(OptimizerMethod::lbfgs);
+    optimizer.set_stop_criteria(criteria);
+    optimizer();
+    ASSERT_TRUE(optimizer.is_solved());
+    ASSERT_NEAR(optimizer.get_solution()[1], 1, 1e-6);
+
+    Model model;
+    model.add_variables("x y");
+    model.get_variables()[0]->set_value(1); // the gradient vanishes at the origin
+    model.get_variables()[1]->set_value(1);
+    model.set_method(SolverMethod::lbfgs);
+    ASSERT_LT(model.solve_now("x * x + y * y - 100\nx - y"), 1e-10);
+}
+
+TEST(Diff, Parser)
+{
+    Parser parser;
+    parser.add_variables("x  y x");
+    ASSERT_EQ(parser.get_variables().size(), 2);
+    parser.get_variables()[0]->set_value(2);
+    parser.get_variables()[1]->set_value(3);
+
+    auto value = [&parser](std::string_view equation) {
+        double root = std::sqrt((*parser.make_equation(equation))());
+        return root;
+    };
+
+    ASSERT_DOUBLE_EQ(value("x + y * 2"), 8);
+    ASSERT_DOUBLE_EQ(value("( x + y ) * 2"), 10);
+    ASSERT_DOUBLE_EQ(value("2 ^ 3 ^ 2"), 64); // ^ is left-associative
+    ASSERT_DOUBLE_EQ(value("sin x ^ 2"), std::sin(2) * std::sin(2));
+    ASSERT_DOUBLE_EQ(value("y - x - 1 + 10"), 10);
+    ASSERT_DOUBLE_EQ(value("# comment\n\n  x   -   +1.5e0  "), 0.5);
+    ASSERT_DOUBLE_EQ((*parser.make_equation("x\ny"))(), 13);
+
+    ASSERT_THROW(parser.make_equation("( x + y"), std::string);
+    ASSERT_THROW(parser.make_equation("x + y )"), std::string);
+    ASSERT_THROW(parser.make_equation("x y"), std::string);
+    ASSERT_THROW(parser.make_equation("x + z"), std::string);
+    ASSERT_THROW(parser.make_equation("x + 1.5z"), std::string);
+    ASSERT_THROW(parser.make_equation("# only a comment"), std::string);
+
+    std::string equation = "x";
+    for (int i = 0; i < 20000; ++i) {
+        equation += " + ( x * y - 6 )";
+    }
+    ASSERT_DOUBLE_EQ(value(equation), 2);
+}
+
+TEST(Diff, SystemCache)
+{
+    ASSERT_EQ(SystemCache::key_of(" x  y", "# c\n x +  y\n\nx - 1 "), SystemCache::key_of("x y", "x + y\nx - 1"));
+    ASSERT_NE(SystemCache::key_of("x y", "x + y"), SystemCache::key_of("y x", "x + y"));
+    ASSERT_NE(SystemCache::key_of("x", "x - 1"), SystemCache::key_of("x", "x - 2"));
+
+    SystemCache cache(2);
+    Parser parser;
+    parser.add_variables("x");
+    auto a = std::make_shared<const Tape>(parser.make_equation("x - 1"), parser.get_variables());
+    auto b = std::make_shared<const Tape>(parser.make_equation("x - 2"), parser.get_variables());
+    auto c = std::make_shared<const Tape>(parser.make_equation("x - 3"), parser.get_variables());
+
+    ASSERT_EQ(cache.find("a"), nullptr);
+    cache.insert("a", a);
+    cache.insert("b", b);
+    ASSERT_EQ(cache.find("a"), a);
+    cache.insert("c", c); // b is the least recently used
+    ASSERT_EQ(cache.find("b"), nullptr);
+    ASSERT_EQ(cache.find("c"), c);
+    ASSERT_EQ(cache.find("a"), a);
+    ASSERT_EQ(cache.size(), 2);
+    ASSERT_EQ(cache.hits(), 3);
+    ASSERT_EQ(cache.misses(), 2);
+
+    std::istringstream in("x\nx - 1\n\nx\n x  - 1\n\nx\nx - 2\n");
+    std::ostringstream out;
+    auto shared = std::make_shared<SystemCache>();
+    BatchSolver(std::make_shared<ThreadPool>(1), 1, 4, shared)(in, out);
+    ASSERT_EQ(shared->hits(), 1);
+    ASSERT_EQ(shared->misses(), 2);
+}
 
-    auto f = x * x + CONST(3) * x + CONST(2);
+TEST(Diff, Residuals)
+{
+    Parser parser;
+    parser.add_variables("x y z");
+    parser.get_variables()[0]->set_value(1);
+    parser.get_variables()[1]->set_value(2);
+    parser.get_variables()[2]->set_value(3);
+
+    Residuals residuals(parser.make_residuals("x * y - 1\nsin z\n4"), parser.get_variables());
+    const SparseMatrix &pattern = residuals.pattern();
+
+    ASSERT_EQ(residuals.size(), 3);
+    ASSERT_EQ(pattern.row_start, (std::vector<std::size_t>{0, 2, 3, 3}));
+    ASSERT_EQ(pattern.columns, (std::vector<std::size_t>{0, 1, 2}));
+
+    ResidualState state = residuals.make_state();
+    std::vector<double> r(3);
+    SparseMatrix jacobian = pattern;
+    residuals.jacobian(state, r.data(), jacobian);
+
+    ASSERT_DOUBLE_EQ(r[0], 1);
+    ASSERT_DOUBLE_EQ(r[1], std::sin(3));
+    ASSERT_DOUBLE_EQ(r[2], 4);
+    ASSERT_DOUBLE_EQ(jacobian.values[0], 2);
+    ASSERT_DOUBLE_EQ(jacobian.values[1], 1);
+    ASSERT_DOUBLE_EQ(jacobian.values[2], std::cos(3));
+
+    std::vector<double> v{1, 1, 1};
+    std::vector<double> jv(3);
+    std::vector<double> jtr(3);
+    jacobian.multiply(v.data(), jv.data());
+    jacobian.multiply_transposed(r.data(), jtr.data());
+    ASSERT_DOUBLE_EQ(jv[0], 3);
+    ASSERT_DOUBLE_EQ(jv[2], 0);
+    ASSERT_DOUBLE_EQ(jtr[0], 2);
+    ASSERT_DOUBLE_EQ(jtr[2], std::cos(3) * std::sin(3));
+}
+
+TEST(Diff, CompressedJacobian)
+{
+    // chain x0 x1, x1 x2, ...: every column meets only its neighbours, three colors are enough
+    Parser parser;
+    std::string names;
+    std::string equations;
+    const int n = 30;
+    for (int i = 0; i < n; ++i) {
+        names += "x" + std::to_string(i) + " ";
+    }
+    for (int i = 0; i + 1 < n; ++i) {
+        equations += "x" + std::to_string(i) + " * x" + std::to_string(i + 1) + " - sin x" + std::to_string(i) + " - 1\n";
+    }
+    equations += "x0 + x" + std::to_string(n - 1) + " + x" + std::to_string(n / 2) + "\n";
+    parser.add_variables(names);
+    for (int i = 0; i < n; ++i) {
+        parser.get_variables()[i]->set_value(0.1 * i - 1);
+    }
+
+    auto residuals = parser.make_residuals(equations);
+    Residuals rows(residuals, parser.get_variables(), DiffMode::reverse);
+    Residuals colored(residuals, parser.get_variables(), DiffMode::forward);
+
+    ASSERT_EQ(rows.sweeps(), n);
+    ASSERT_LE(colored.sweeps(), 4);
+
+    std::vector<std::size_t> colors;
+    const SparseMatrix &pattern = colored.pattern();
+    pattern.color_columns(colors);
+    for (std::size_t i = 0; i < pattern.rows; ++i) {
+        for (std::size_t a = pattern.row_start[i]; a < pattern.row_start[i + 1]; ++a) {
+            for (std::size_t b = a + 1; b < pattern.row_start[i + 1]; ++b) {
+                ASSERT_NE(colors[pattern.columns[a]], colors[pattern.columns[b]]);
+            }
+        }
+    }
+
+    ResidualState row_state = rows.make_state();
+    ResidualState colored_state = colored.make_state();
+    SparseMatrix row_jacobian = rows.pattern();
+    SparseMatrix colored_jacobian = colored.pattern();
+    std::vector<double> row_r(n);
+    std::vector<double> colored_r(n);
+    rows.jacobian(row_state, row_r.data(), row_jacobian);
+    colored.jacobian(colored_state, colored_r.data(), colored_jacobian);
+
+    ASSERT_EQ(row_jacobian.columns, colored_jacobian.columns);
+    for (int i = 0; i < n; ++i) {
+        ASSERT_DOUBLE_EQ(row_r[i], colored_r[i]);
+    }
+    for (std::size_t k = 0; k < row_jacobian.values.size(); ++k) {
+        ASSERT_NEAR(row_jacobian.values[k], colored_jacobian.values[k], 1e-12);
+    }
+}
+
+TEST(Diff, LevenbergMarquardt)
+{
+    Parser parser;
+    parser.add_variables("x y");
+    parser.get_variables()[0]->set_value(1);
+    parser.get_variables()[1]->set_value(1);
+
+    // circle and line, the same system as MultiStart but away from the stationary origin
+    auto residuals = std::make_shared<const Residuals>(parser.make_residuals("x * x + y * y - 100\nx - y"), parser.get_variables());
+    LevenbergMarquardt solver(residuals, {}, 1e-3, 50);
+    solver();
+
+    ASSERT_TRUE(solver.is_solved());
+    ASSERT_NEAR(solver.get_solution()[0], std::sqrt(50), 1e-9);
+    ASSERT_NEAR(solver.get_solution()[1], std::sqrt(50), 1e-9);
+    ASSERT_EQ(parser.get_variables()[0]->get_value(), 1);
+
+    auto colored = std::make_shared<const Residuals>(parser.make_residuals("x * x + y * y - 100\nx - y"), parser.get_variables(), DiffMode::forward);
+    LevenbergMarquardt colored_solver(colored, {}, 1e-3, 50);
+    colored_solver();
+    ASSERT_TRUE(colored_solver.is_solved());
+    ASSERT_NEAR(colored_solver.get_solution()[0], solver.get_solution()[0], 1e-9);
+
+    solver.write_parameters();
+    ASSERT_DOUBLE_EQ(parser.get_variables()[0]->get_value(), solver.get_solution()[0]);
+
+    // more equations than unknowns, a least squares fit: 1, 2, 3 at t = 0, 1, 2 is 1 + t
+    Parser fit;
+    fit.add_variables("a b");
+    auto line = std::make_shared<const Residuals>(fit.make_residuals("a - 1\na + b - 2\na + 2 * b - 3\na + b * 3 - 4"));
+    LevenbergMarquardt least_squares(line, {10, -10});
+    least_squares();
+
+    ASSERT_NEAR(least_squares.get_solution()[0], 1, 1e-9);
+    ASSERT_NEAR(least_squares.get_solution()[1], 1, 1e-9);
+}
+
+TEST(Diff, HessianVector)
+{
+    Parser parser;
+    parser.add_variables("x y z");
+    auto &variables = parser.get_variables();
+    variables[0]->set_value(0.7);
+    variables[1]->set_value(-1.3);
+    variables[2]->set_value(2.1);
+
+    auto tape = std::make_shared<const Tape>(parser.make_equation("x * y - sin z / y\ncos ( x * z ) + y ^ 3 - z + x ^ 2.5"), variables);
+    TapeState state = tape->make_state();
+    const std::vector<double> direction{0.5, -2, 1};
+    Grad<double> gradient(std::vector<double>(3, 0));
+    Grad<double> product(std::vector<double>(3, 0));
+    tape->hessian_vector(state, direction.data(), gradient, product);
+
+    Grad<double> reverse = tape->make_grad(state);
+    // central differences of the gradient along the direction
+    const double h = 1e-6;
+    TapeState shifted = tape->make_state();
+    for (std::size_t i = 0; i < 3; ++i) {
+        shifted.point[i] += h * direction[i];
+    }
+    Grad<double> ahead = tape->make_grad(shifted);
+    for (std::size_t i = 0; i < 3; ++i) {
+        shifted.point[i] -= 2 * h * direction[i];
+    }
+    Grad<double> behind = tape->make_grad(shifted);
+
+    for (std::size_t i = 0; i < 3; ++i) {
+        ASSERT_DOUBLE_EQ(gradient[i], reverse[i]);
+        ASSERT_NEAR(product[i], (ahead[i] - behind[i]) / (2 * h), 1e-5 * (1 + std::abs(product[i])));
+    }
+}
+
+TEST(Diff, NewtonSolver)
+{
+    Parser parser;
+    parser.add_variables("x y");
+    parser.get_variables()[0]->set_value(1);
+    parser.get_variables()[1]->set_value(1);
+
+    auto tape = std::make_shared<const Tape>(parser.make_equation("x * x + y * y - 100\nx - y"), parser.get_variables());
+    NewtonSolver solver(tape, {}, 1, 100);
+    solver();
+
+    ASSERT_TRUE(solver.is_solved());
+    ASSERT_NEAR(solver.get_solution()[0], std::sqrt(50), 1e-9);
+    ASSERT_NEAR(solver.get_solution()[1], std::sqrt(50), 1e-9);
+    ASSERT_EQ(parser.get_variables()[0]->get_value(), 1);
+
+    // negative curvature at the start, the trust region still goes downhill: (x^2 - 1)^2 from 0.1
+    Parser quartic;
+    quartic.add_variables("x");
+    auto well = std::make_shared<const Tape>(quartic.make_equation("x * x - 1"), quartic.get_variables());
+    NewtonSolver from_top(well, {0.1});
+    from_top();
+    ASSERT_TRUE(from_top.is_solved());
+    ASSERT_NEAR(std::abs(from_top.get_solution()[0]), 1, 1e-9);
+}
+
+TEST(Diff, Profiler)
+{
+    const Profile start = Profiler::snapshot();
+
+    Parser parser;
+    parser.add_variables("x y");
+    parser.get_variables()[0]->set_value(1);
+    parser.get_variables()[1]->set_value(1);
+    auto tape = std::make_shared<const Tape>(parser.make_equation("x * x + y * y - 100\nx - y"), parser.get_variables());
+    NewtonSolver solver(tape);
+    solver();
+
+    const Profile profile = Profiler::snapshot() - start;
+    const std::string json = profile.to_json();
+    ASSERT_EQ(json.front(), '{');
+    ASSERT_NE(json.find("\"gradient_calls\":"), std::string::npos);
+    ASSERT_NE(json.find("\"solve\":"), std::string::npos);
+    ASSERT_NE(json.find("\"gradient\":"), std::string::npos);
+    ASSERT_NE(json.find("\"update\":"), std::string::npos);
+
+    if constexpr (!Profiler::enabled) {
+        ASSERT_EQ(profile[ProfileCounter::nodes_built], 0);
+        ASSERT_EQ(profile.seconds(ProfilePhase::parse), 0);
+        return;
+    }
+
+    ASSERT_GT(profile[ProfileCounter::nodes_built], 0);
+    ASSERT_GT(profile[ProfileCounter::arena_bytes], 0);
+    ASSERT_GE(profile[ProfileCounter::node_evaluations], tape->size() * profile[ProfileCounter::gradient_calls]);
+    ASSERT_GT(profile[ProfileCounter::iterations], 0);
+    ASSERT_GT(profile.seconds(ProfilePhase::parse), 0);
+    ASSERT_GT(profile.seconds(ProfilePhase::compile), 0);
+    ASSERT_GT(profile.seconds(ProfilePhase::gradient), 0);
+
+    // a solve queued behind a long one is measured without it
+    Model model;
+    model.add_variables("x");
+    StopCriteria criteria;
+    criteria.deadline = std::chrono::milliseconds(20);
+    model.set_stop_criteria(criteria);
+    model.solve("sin x + 2");
+    model.set_method(SolverMethod::newton);
+    model.solve_now("x - 3");
+    ASSERT_LT(model.get_profile()[ProfileCounter::iterations], 1000);
+    ASSERT_GT(model.get_profile().seconds(ProfilePhase::parse), 0);
+
+    // the time of a solve splits into gradients and updates
+    const Profile solved = model.get_profile();
+    ASSERT_GT(solved.seconds(ProfilePhase::gradient), 0);
+    ASSERT_LE(solved.seconds(ProfilePhase::gradient), solved.seconds(ProfilePhase::solve));
+    ASSERT_GT(solved.update_seconds(), 0);
+    ASSERT_DOUBLE_EQ(solved.update_seconds() + solved.seconds(ProfilePhase::gradient), solved.seconds(ProfilePhase::solve));
+}
+
+TEST(Diff, BatchSolver)
+{
+    std::istringstream in(
+        "{\"id\": \"a\", \"variables\": \"x y\", \"equations\": [\"x + y - 3\", \"x - y - 1\"]}\n"
+        "x\n"
+        "x * x - 4\n"
+        "\n"
+        "{\"variables\": \"x\", \"equations\": \"x + + 1\"}\n"
+        "{\"variables\": \"x\"\n"
+        "{\"id\": 9, \"variables\": \"x\", \"equations\": \"x * x + 1\"}\n"
+        "{\"id\": 1x\", \"variables\": \"x\", \"equations\": \"x - 1\"}\n");
+    std::ostringstream out;
+
+    ASSERT_EQ(BatchSolver(std::make_shared<ThreadPool>(2), 2)(in, out), 6);
+
+    std::istringstream lines(out.str());
+    std::vector<std::string> results;
+    for (std::string line; std::getline(lines, line);) {
+        results.push_back(line);
+    }
 
-    std::string eq = "";
-    f->get_equation(eq);
-    ASSERT_EQ(eq, "(x)*(x)+(3.000000)*(x)+2.000000");
+    ASSERT_EQ(results.size(), 6);
+    ASSERT_EQ(results[0].rfind("{\"id\":\"a\",\"solved\":true,", 0), 0);
+    ASSERT_NEAR(std::stod(results[0].substr(results[0].find("\"x\":") + 4)), 2, 1e-6);
+    ASSERT_EQ(results[1].rfind("{\"id\":1,\"solved\":true,", 0), 0);
+    ASSERT_EQ(results[2], "{\"id\":2,\"error\":\"invalid exp\"}");
+    ASSERT_EQ(results[3], "{\"id\":3,\"error\":\"invalid json\"}");
+    ASSERT_EQ(results[4].rfind("{\"id\":9,\"solved\":false,", 0), 0);
+    ASSERT_EQ(results[5], "{\"id\":5,\"error\":\"invalid id\"}");
 }
 
 int main(int argc, char *argv[])
@@ -0,0 +1,52 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+
+ThreadPool::ThreadPool(std::size_t threads)
+{
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (std::size_t i = 0; i < threads; ++i) {
+        workers_.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lk(mut_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+
+    for (auto &x : workers_) {
+        x.join();
+    }
+}
+
+std::size_t ThreadPool::size()
+{
+    return workers_.size();
+}
+
+void ThreadPool::work()
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lk(mut_);
+            cv_.wait(lk, [this] { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+
+            task = std::move(tasks_.front());
+            tasks_.pop();
+        }
+
+        task();
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, the destructor finishes the queued tasks and joins them
+class ThreadPool
+{
+    std::vector<std::thread> workers_{};
+    std::queue<std::function<void()>> tasks_{};
+    std::mutex mut_{};
+    std::condition_variable cv_{};
+    bool stop_{false};
+public:
+    // 0 threads means one per hardware thread
+    ThreadPool(std::size_t threads = 0);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    std::size_t size();
+
+    template<typename F>
+    auto submit(F f) -> std::future<decltype(f())>
+    {
+        auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+        auto result = task->get_future();
+        {
+            std::lock_guard lk(mut_);
+            tasks_.push([task] { (*task)(); });
+        }
+        cv_.notify_one();
+
+        return result;
+    }
+private:
+    void work();
+};
+
+#endif // THREADPOOL_H